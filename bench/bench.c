@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+
+#include "core.h"
+
+// drives a running cellwm with XTest key presses and its own windows
+// usage: bench <windows|half|full> [reps]
+
+// must match cellh and the current cell's color in wm.c
+#define CELLH 32
+#define LIGHTBLUE 0xADD8E6
+
+// every slot of the grid taken, more windows go to the hand
+#define CELLS (ROWS * COLS)
+#define MAXWINDOWS (CELLS * SLOTS)
+
+#define TIMEOUT_MS 2000
+
+Display *dpy;
+Window root;
+int sw;
+
+Window *wins;
+int nwins;
+
+// where the WM is, as far as we know
+int cx = 1, cy = 1;
+
+// waits that gave up, a sample ending in one is dropped and counted, and
+// any of them makes the run fail
+int timeouts;
+
+int
+clip(int n, int max)
+{
+    return (n < 1) ? max : (n > max) ? 1 : n;
+}
+
+int64_t
+now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool
+ours(Window w)
+{
+    for (int i = 0; i < nwins; i++)
+        if (wins[i] == w)
+            return true;
+    return false;
+}
+
+void
+key(KeySym sym, bool shift)
+{
+    KeyCode alt = XKeysymToKeycode(dpy, XK_Alt_L);
+    KeyCode shiftk = XKeysymToKeycode(dpy, XK_Shift_L);
+    KeyCode k = XKeysymToKeycode(dpy, sym);
+
+    XTestFakeKeyEvent(dpy, alt, True, CurrentTime);
+    if (shift)
+        XTestFakeKeyEvent(dpy, shiftk, True, CurrentTime);
+    XTestFakeKeyEvent(dpy, k, True, CurrentTime);
+    XTestFakeKeyEvent(dpy, k, False, CurrentTime);
+    if (shift)
+        XTestFakeKeyEvent(dpy, shiftk, False, CurrentTime);
+    XTestFakeKeyEvent(dpy, alt, False, CurrentTime);
+    XFlush(dpy);
+}
+
+// wait for a notify on a top level window, None matches any window that
+// is not ours, width >= 0 only matches a ConfigureNotify of that width and
+// y >= 0 one at that y
+bool
+wait_for(int type, Window w, int width, int y)
+{
+    int64_t end = now_us() + TIMEOUT_MS * 1000;
+    XEvent ev;
+
+    while (now_us() < end) {
+        if (!XPending(dpy)) {
+            struct pollfd pfd = { ConnectionNumber(dpy), POLLIN, 0 };
+            poll(&pfd, 1, 10);
+            continue;
+        }
+        XNextEvent(dpy, &ev);
+        if (ev.type != type)
+            continue;
+
+        Window got = (type == ConfigureNotify) ? ev.xconfigure.window :
+                     (type == MapNotify) ? ev.xmap.window :
+                     (type == UnmapNotify) ? ev.xunmap.window :
+                     ev.xdestroywindow.window;
+        if ((w == None) ? ours(got) : (got != w))
+            continue;
+        if ((type == ConfigureNotify) && (width >= 0) && (ev.xconfigure.width != width))
+            continue;
+        if ((type == ConfigureNotify) && (y >= 0) && (ev.xconfigure.y != y))
+            continue;
+        return true;
+    }
+    fprintf(stderr, "bench: timed out waiting for event %d\n", type);
+    timeouts++;
+    return false;
+}
+
+// x of the highlighted cell in the bar, read back from the screen
+int
+bar_x()
+{
+    XImage *img = XGetImage(dpy, root, 0, CELLH - 2, sw, 1, AllPlanes, ZPixmap);
+    int x = -1;
+    for (int i = 0; (img != NULL) && (i < sw); i++)
+        if ((XGetPixel(img, i, 0) & 0xFFFFFF) == LIGHTBLUE) {
+            x = i;
+            break;
+        }
+    if (img != NULL)
+        XDestroyImage(img);
+    return x;
+}
+
+bool
+wait_bar(int from)
+{
+    int64_t end = now_us() + TIMEOUT_MS * 1000;
+    while (now_us() < end)
+        if (bar_x() != from)
+            return true;
+    fprintf(stderr, "bench: timed out waiting for the bar\n");
+    timeouts++;
+    return false;
+}
+
+// the cell at row y, column x, columns past 9 have no num key of their
+// own and are stepped to
+void
+move_to(int y, int x)
+{
+    while (cy != y) {
+        int from = bar_x();
+        key(XK_Down, false);
+        cy = clip(cy + 1, ROWS);
+        // the highlight only moves if the column differs, settle otherwise
+        if (cx == x)
+            XSync(dpy, False);
+        else
+            wait_bar(from);
+    }
+    while (cx != x) {
+        int from = bar_x();
+        if (x <= 9) {
+            key(XK_1 + x - 1, true);
+            cx = x;
+        } else {
+            key(XK_Right, false);
+            cx = clip(cx + 1, COLS);
+        }
+        wait_bar(from);
+    }
+}
+
+Window
+new_window()
+{
+    Window w = XCreateSimpleWindow(dpy, root, 0, 0, 100, 100, 0, 0, 0);
+    wins = realloc(wins, (nwins + 1) * sizeof(Window));
+    wins[nwins++] = w;
+    XMapWindow(dpy, w);
+    XFlush(dpy);
+    return w;
+}
+
+void
+destroy_window(Window w)
+{
+    XDestroyWindow(dpy, w);
+    wait_for(DestroyNotify, w, -1, -1);
+    for (int i = 0; i < nwins; i++)
+        if (wins[i] == w)
+            wins[i] = wins[--nwins];
+}
+
+int
+cmp(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// percentiles over the reps samples that completed, with the timeouts
+// since the previous report
+void
+report(int n, const char *metric, int64_t *us, int reps)
+{
+    static int reported;
+    int lost = timeouts - reported;
+    reported = timeouts;
+
+    if (reps == 0) {
+        printf("{\"windows\": %d, \"metric\": \"%s\", \"n\": 0, \"timeouts\": %d}\n",
+               n, metric, lost);
+        return;
+    }
+    qsort(us, reps, sizeof(int64_t), cmp);
+    printf("{\"windows\": %d, \"metric\": \"%s\", \"n\": %d, \"timeouts\": %d, "
+           "\"p50_us\": %lld, \"p90_us\": %lld, \"p99_us\": %lld, \"max_us\": %lld}\n",
+           n, metric, reps, lost,
+           (long long)us[reps / 2], (long long)us[reps * 90 / 100],
+           (long long)us[reps * 99 / 100], (long long)us[reps - 1]);
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: bench <windows|half|full> [reps]\n");
+        return 1;
+    }
+    // half and full are as many windows as half and all the slots, so
+    // the scripts need not know the grid
+    int n = (strcmp(argv[1], "half") == 0) ? MAXWINDOWS / 2 :
+            (strcmp(argv[1], "full") == 0) ? MAXWINDOWS : atoi(argv[1]);
+    int reps = (argc > 2) ? atoi(argv[2]) : 200;
+    if ((n < 0) || (n > MAXWINDOWS) || (reps < 1)) {
+        fprintf(stderr, "bench: windows must be 0-%d, reps at least 1\n", MAXWINDOWS);
+        return 1;
+    }
+
+    dpy = XOpenDisplay(NULL);
+    if (dpy == NULL) {
+        fprintf(stderr, "bench: cannot open display\n");
+        return 1;
+    }
+    int ev, err, major, minor;
+    if (!XTestQueryExtension(dpy, &ev, &err, &major, &minor)) {
+        fprintf(stderr, "bench: no XTest\n");
+        return 1;
+    }
+    root = DefaultRootWindow(dpy);
+    sw = DisplayWidth(dpy, DefaultScreen(dpy));
+    XSelectInput(dpy, root, SubstructureNotifyMask);
+
+    int64_t *us = calloc(2 * reps, sizeof(int64_t));
+
+    // fill cells SLOTS windows at a time, from the first cell on
+    for (int i = 0; i < n; i++) {
+        Window w = new_window();
+        wait_for(ConfigureNotify, w, -1, CELLH);
+        int cell = (i / SLOTS) + 1;
+        if ((i % SLOTS == SLOTS - 1) && (cell < CELLS))
+            move_to(cell / COLS + 1, cell % COLS + 1);
+    }
+
+    // cell switch, key press to the bar showing the new cell
+    // filling the cells may have given up somewhere already
+    if (timeouts > 0)
+        report(n, "setup", us, 0);
+    int got = 0;
+    for (int r = 0; r < reps; r++) {
+        int from = bar_x();
+        int64_t t = now_us();
+        key(XK_Right, false);
+        if (wait_bar(from))
+            us[got++] = now_us() - t;
+        cx = clip(cx + 1, COLS);
+    }
+    report(n, "cell_switch", us, got);
+
+    // layout toggle, key press to the primary window resized to a tile,
+    // with a single slot the layouts look the same and there is nothing
+    // to wait for
+    move_to(1, 1);
+    Window primary = (n > 0) ? wins[0] : None;
+    if ((n < 2) && (SLOTS > 1)) {
+        if (n == 0) {
+            primary = new_window();
+            wait_for(ConfigureNotify, primary, -1, CELLH);
+        }
+        Window w = new_window();
+        wait_for(ConfigureNotify, w, -1, CELLH);
+    }
+    got = 0;
+    for (int r = 0; (r < reps) && (SLOTS > 1); r++) {
+        int64_t t = now_us();
+        key(XK_t, false);
+        if (wait_for(ConfigureNotify, primary, sw/SLOTS, -1))
+            us[got++] = now_us() - t;
+
+        t = now_us();
+        key(XK_m, false);
+        if (wait_for(ConfigureNotify, primary, sw, -1))
+            us[got++] = now_us() - t;
+    }
+    report(n, "layout_toggle", us, got);
+
+    // map, window mapped to placed in a cell, or to the hand card when full
+    bool full = (n == MAXWINDOWS);
+    if (!full) {
+        // below two windows, the layout test put them in the first cell
+        int cell = (n < 2) ? 1 : n / SLOTS;
+        if (cell < CELLS)
+            move_to(cell / COLS + 1, cell % COLS + 1);
+    }
+    got = 0;
+    for (int r = 0; r < reps; r++) {
+        int64_t t = now_us();
+        Window w = new_window();
+        if (full ? wait_for(MapNotify, None, -1, -1) : wait_for(ConfigureNotify, w, -1, CELLH))
+            us[got++] = now_us() - t;
+
+        destroy_window(w);
+        if (full)
+            wait_for(UnmapNotify, None, -1, -1);
+    }
+    report(n, "map", us, got);
+
+    XCloseDisplay(dpy);
+    return (timeouts > 0) ? 1 : 0;
+}
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "core.h"
+
+// drives the core alone with random events, the way the backend would,
+// and counts what it costs
+// usage: corebench [ops] [windows]
+
+// every allocation made while measuring, see the wrap flags in the Makefile
+unsigned long allocs;
+
+void *__real_malloc(size_t n);
+void *__real_calloc(size_t n, size_t m);
+void *__real_realloc(void *p, size_t n);
+
+void *
+__wrap_malloc(size_t n)
+{
+    allocs++;
+    return __real_malloc(n);
+}
+
+void *
+__wrap_calloc(size_t n, size_t m)
+{
+    allocs++;
+    return __real_calloc(n, m);
+}
+
+void *
+__wrap_realloc(void *p, size_t n)
+{
+    allocs++;
+    return __real_realloc(p, n);
+}
+
+// windows the core knows about, by position, and the position of each one
+// by pool slot, so a forgotten one is dropped in constant time
+Client *live[MAXCLIENTS];
+int pos[MAXCLIENTS];
+int nlive;
+
+unsigned long nextwin = 1;
+unsigned long xops;
+
+uint64_t rng = 0x2545F4914F6CDD1Dull;
+
+unsigned int
+rnd(unsigned int n)
+{
+    // xorshift64
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return (rng >> 32) % n;
+}
+
+int64_t
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// what the backend does once per frame, minus the server
+void
+frame()
+{
+    if (dirty & (DirtyLayout | DirtyView)) {
+        update_cell_layout();
+        update_view();
+    }
+    dirty = 0;
+
+    for (unsigned int i = 0; i < nops; i++) {
+        if (ops[i].type != OpForget)
+            continue;
+        Client *c = ops[i].c;
+        int p = pos[c - pool];
+        live[p] = live[--nlive];
+        pos[live[p] - pool] = p;
+        free_client(c);
+    }
+    xops += nops;
+    nops = 0;
+}
+
+void
+step(int windows)
+{
+    Arg arg;
+
+    // keep around the wanted number of windows
+    unsigned int r = rnd(16);
+    if ((r < 3) && (nlive >= windows))
+        r = 3;
+    if ((r == 3) && (nlive == 0))
+        r = 0;
+
+    switch (r) {
+        case 0: case 1: case 2: {
+            // always a new window, NULL once the pool is full
+            Client *c = client_mapped(nextwin++);
+            if (c != NULL) {
+                pos[c - pool] = nlive;
+                live[nlive++] = c;
+            }
+            break;
+        }
+        case 3:
+            // the window went away on its own
+            forget_client(live[rnd(nlive)]);
+            break;
+        case 4:
+            goto_cell(1 + rnd(ROWS), 1 + rnd(COLS));
+            break;
+        case 5:
+            arg.i = rnd(2) ? 1 : -1;
+            step_column(&arg);
+            break;
+        case 6:
+            arg.i = rnd(2) ? 1 : -1;
+            step_row(&arg);
+            break;
+        case 7:
+            arg.i = rnd(2) ? 1 : -1;
+            goto_occupied(&arg);
+            break;
+        case 8:
+            goto_empty(NULL);
+            break;
+        case 9:
+            view_previous(NULL);
+            break;
+        case 10: case 11:
+            place_hand(NULL);
+            break;
+        case 12:
+            pickup_hand(NULL);
+            break;
+        case 13:
+            flip_cell(NULL);
+            break;
+        case 14:
+            arg.i = rnd(2) ? Tiled : Monocle;
+            set_layout(&arg);
+            break;
+        case 15:
+            kill_client(NULL);
+            break;
+    }
+    frame();
+}
+
+int
+main(int argc, char *argv[])
+{
+    long n = (argc > 1) ? atol(argv[1]) : 5000000;
+    int windows = (argc > 2) ? atoi(argv[2]) : 300;
+    if ((n < 1) || (windows < 1) || (windows > MAXCLIENTS)) {
+        fprintf(stderr, "corebench: ops at least 1, windows 1-%d\n", MAXCLIENTS);
+        return 1;
+    }
+
+    set_viewport(0, 32, 1920, 1048);
+
+    // warm up to the steady state, buffers reach their size here
+    for (long i = 0; i < n / 10; i++)
+        step(windows);
+
+    allocs = 0;
+    xops = 0;
+    int64_t t = now_ns();
+    for (long i = 0; i < n; i++)
+        step(windows);
+    t = now_ns() - t;
+
+    printf("{\"ops\": %ld, \"windows\": %d, \"live\": %d, \"hand\": %u, "
+           "\"ops_per_sec\": %.0f, \"allocs_per_op\": %.6f, \"x_ops_per_op\": %.3f}\n",
+           n, windows, nlive, nhand, n * 1e9 / t,
+           (double)allocs / n, (double)xops / n);
+    return 0;
+}
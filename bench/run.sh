@@ -0,0 +1,61 @@
+#!/bin/sh
+# start cellwm under Xvfb for each window count and benchmark it
+# usage: bench/run.sh [reps]
+
+reps=${1:-200}
+status=0
+
+# poll every 50ms for up to 5s until the command succeeds, giving up early
+# once the process behind it is gone
+wait_until() {
+    pid=$1
+    shift
+    tries=0
+    while ! "$@"; do
+        if ! kill -0 $pid 2>/dev/null || [ $tries -ge 100 ]; then
+            return 1
+        fi
+        sleep 0.05
+        tries=$((tries + 1))
+    done
+}
+
+for n in 0 20 half full; do
+    # Xvfb picks a free display itself and writes its number once it
+    # accepts clients, so a server already running is never benchmarked
+    dfile=$(mktemp)
+    Xvfb -displayfd 3 -screen 0 1920x1080x24 -nolisten tcp 3>"$dfile" >/dev/null 2>&1 &
+    xvfb=$!
+    if ! wait_until $xvfb test -s "$dfile"; then
+        echo "run.sh: Xvfb did not start" >&2
+        kill $xvfb 2>/dev/null
+        rm -f "$dfile"
+        exit 1
+    fi
+    disp=:$(cat "$dfile")
+    rm -f "$dfile"
+
+    # cellwm is ready once its control socket is up, everything else is
+    # set up by then
+    if [ -n "$XDG_RUNTIME_DIR" ]; then
+        sock=$XDG_RUNTIME_DIR/cellwm-$disp.sock
+    else
+        sock=/tmp/cellwm-$(id -u)-$disp.sock
+    fi
+    DISPLAY=$disp ./cellwm >/dev/null 2>&1 &
+    wm=$!
+    if ! wait_until $wm test -S "$sock"; then
+        echo "run.sh: cellwm did not start on $disp" >&2
+        kill $wm $xvfb 2>/dev/null
+        wait $wm $xvfb 2>/dev/null
+        exit 1
+    fi
+
+    DISPLAY=$disp bench/bench $n $reps || status=1
+
+    kill $wm $xvfb
+    wait $wm $xvfb 2>/dev/null
+    # killed, cellwm does not get to clean up after itself
+    rm -f "$sock"
+done
+exit $status
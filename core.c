@@ -0,0 +1,628 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "core.h"
+
+Client pool[MAXCLIENTS];
+unsigned int npool;
+unsigned short free_slots[MAXCLIENTS];
+unsigned int nfree;
+
+// index of all clients keyed by window, open addressing with linear probing
+// at most half full, so lookups stay flat however many windows are open
+#define CLIENTS_CAP (2 * MAXCLIENTS)
+Client* clients[CLIENTS_CAP];
+unsigned int nclients;
+
+Cell cells[ROWS + 1][COLS + 1];
+
+unsigned int occupied[ROWS + 1];
+unsigned int rows_occupied, rows_full;
+
+int ccx = 1;
+int ccy = 1;
+int pcx = 1;
+int pcy = 1;
+
+int hand_top = -1, hand_bottom = -1;
+unsigned int nhand;
+
+unsigned long mapped[SLOTS];
+int viewy, viewx;
+
+// hot cells as y * (COLS + 1) + x, most recently left first
+int hot[HOTCELLS + 1];
+int nhot;
+
+unsigned int dirty;
+
+// grows to the longest batch between two frames, then stays put
+Op *ops;
+unsigned int nops, ops_cap;
+
+// where the windows of a cell go, below the bar
+struct {
+    int x, y, w, h;
+} viewport;
+
+void
+set_viewport(int x, int y, int w, int h)
+{
+    viewport.x = x;
+    viewport.y = y;
+    viewport.w = w;
+    viewport.h = h;
+}
+
+void
+emit(enum OpType type, Client *c, int x, int y, int w, int h)
+{
+    if (nops == ops_cap) {
+        ops_cap = ops_cap ? ops_cap * 2 : 64;
+        ops = (Op*)realloc(ops, ops_cap * sizeof(Op));
+    }
+    ops[nops++] = (Op){ type, c, c->win, x, y, w, h };
+}
+
+unsigned int
+client_slot(unsigned long w)
+{
+    // fibonacci hashing, XIDs of one connection only differ in the low bits
+    return (unsigned int)(((uint64_t)w * 0x9E3779B97F4A7C15ull) >> 32) & (CLIENTS_CAP - 1);
+}
+
+Client*
+find_client(unsigned long w)
+{
+    for (unsigned int i = client_slot(w); clients[i]; i = (i + 1) & (CLIENTS_CAP - 1))
+        if (clients[i]->win == w)
+            return clients[i];
+    return NULL;
+}
+
+void
+insert_client(Client* cl)
+{
+    unsigned int i = client_slot(cl->win);
+    while (clients[i])
+        i = (i + 1) & (CLIENTS_CAP - 1);
+    clients[i] = cl;
+    nclients++;
+}
+
+void
+delete_client(Client* cl)
+{
+    unsigned int mask = CLIENTS_CAP - 1;
+    unsigned int i = client_slot(cl->win);
+    while (clients[i] != cl)
+        i = (i + 1) & mask;
+    clients[i] = NULL;
+    nclients--;
+
+    // shift back the rest of the probe run so no lookup stops early at the hole
+    for (unsigned int j = (i + 1) & mask; clients[j]; j = (j + 1) & mask) {
+        unsigned int k = client_slot(clients[j]->win);
+        // move entry j into the hole unless its home slot lies in (i, j]
+        if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)))
+            continue;
+        clients[i] = clients[j];
+        clients[j] = NULL;
+        i = j;
+    }
+}
+
+// a fresh client for a window, not placed anywhere yet
+Client*
+new_client(unsigned long w)
+{
+    Client *c;
+    if (nfree > 0)
+        c = &pool[free_slots[--nfree]];
+    else if (npool < MAXCLIENTS)
+        c = &pool[npool++];
+    else
+        return NULL;
+
+    memset(c, 0, sizeof(Client));
+    c->win = w;
+    c->cx = c->cy = -1;
+    c->above = c->below = -1;
+
+    // update global store
+    insert_client(c);
+    return c;
+}
+
+void
+free_client(Client *c)
+{
+    free_slots[nfree++] = c - pool;
+}
+
+// bring the masks in line with a cell whose slots just changed
+void
+update_occupancy(int y, int x)
+{
+    Cell *c = &cells[y][x];
+    bool any = false;
+    for (int s = 0; s < SLOTS; s++)
+        any |= (c->slots[s] != NULL);
+    if (any)
+        occupied[y] |= 1u << x;
+    else
+        occupied[y] &= ~(1u << x);
+
+    if (occupied[y])
+        rows_occupied |= 1u << y;
+    else
+        rows_occupied &= ~(1u << y);
+    if (occupied[y] == ALLCOLS)
+        rows_full |= 1u << y;
+    else
+        rows_full &= ~(1u << y);
+}
+
+// take a window parked off-screen off the screen for good
+void
+unpark(Client *c)
+{
+    if (c->parked) {
+        emit(OpUnmap, c, 0, 0, 0, 0);
+        c->parked = false;
+    }
+}
+
+void
+push_hand(Client *c)
+{
+    int i = c - pool;
+    unpark(c);
+    c->cx = c->cy = -1;
+    c->above = -1;
+    c->below = hand_top;
+    if (hand_top >= 0)
+        pool[hand_top].above = i;
+    else
+        hand_bottom = i;
+    hand_top = i;
+    nhand++;
+
+    dirty |= DirtyHand;
+}
+
+// take a client out of the hand, wherever it is in the stack
+void
+remove_hand(Client *c)
+{
+    if (c->above >= 0)
+        pool[c->above].below = c->below;
+    else
+        hand_top = c->below;
+    if (c->below >= 0)
+        pool[c->below].above = c->above;
+    else
+        hand_bottom = c->above;
+    c->above = c->below = -1;
+    nhand--;
+
+    dirty |= DirtyHand;
+}
+
+// the window is gone or on its way out, drop it from everywhere and never
+// touch it again, the slot stays taken until the backend is done with it
+void
+forget_client(Client *c)
+{
+    if (c->cx == -1) {
+        // still in hand, take it out of the stack
+        remove_hand(c);
+    } else {
+        // undo the mapping in the cells structure
+        Cell *cell = &cells[c->cy][c->cx];
+        for (int s = 0; s < SLOTS; s++)
+            if (cell->slots[s] == c)
+                cell->slots[s] = NULL;
+        update_occupancy(c->cy, c->cx);
+    }
+
+    for (unsigned int m = 0; m < LENGTH(mapped); m++)
+        if (mapped[m] == c->win)
+            mapped[m] = 0;
+    // destroyed, there is nothing left to unmap
+    c->parked = false;
+
+    delete_client(c);
+    emit(OpForget, c, 0, 0, 0, 0);
+    dirty |= DirtyLayout;
+}
+
+// first free slot of a cell, -1 when it is full
+int
+free_slot(Cell *cell)
+{
+    for (int s = 0; s < SLOTS; s++)
+        if (cell->slots[s] == NULL)
+            return s;
+    return -1;
+}
+
+// put a client in a given slot of a cell, 0 for primary, false when the
+// slot does not exist or is taken
+bool
+put_client(Client *c, int y, int x, int slot)
+{
+    if ((slot < 0) || (slot >= SLOTS) || (cells[y][x].slots[slot] != NULL))
+        return false;
+
+    cells[y][x].slots[slot] = c;
+    c->cy = y;
+    c->cx = x;
+    update_occupancy(y, x);
+    return true;
+}
+
+// put a new client in the current cell, or in hand when the cell is full
+void
+place_client(Client *c)
+{
+    // find the right slot to put it in
+    if (!put_client(c, ccy, ccx, free_slot(&cells[ccy][ccx])))
+        push_hand(c);
+}
+
+// a window asks to be mapped, new ones get placed, NULL when out of slots
+Client*
+client_mapped(unsigned long w)
+{
+    // window may already exist
+    Client *c = find_client(w);
+
+    if (c == NULL) {
+        // window does not already exist
+        c = new_client(w);
+        if (c == NULL)
+            return NULL;
+        place_client(c);
+    }
+
+    // map it afresh if it is to be shown, the client may have unmapped it,
+    // parked or not
+    for (unsigned int m = 0; m < LENGTH(mapped); m++)
+        if (mapped[m] == c->win)
+            mapped[m] = 0;
+    c->parked = false;
+
+    dirty |= DirtyLayout;
+    return c;
+}
+
+// wrap a row or column around the edges of the grid
+int
+clip(int n, int max)
+{
+  return (n < 1) ? max : (n > max) ? 1 : n;
+}
+
+// next (dir > 0) or previous cell from the current one in reading order,
+// wrapping around, that is occupied, or empty when asked for, false if none
+bool
+find_cell(bool empty, int dir, int *y, int *x)
+{
+    unsigned int rows = empty ? (~rows_full & ALLROWS) : rows_occupied;
+    if (rows == 0)
+        return false;
+
+    // rest of the current row first
+    unsigned int bits = empty ? (~occupied[ccy] & ALLCOLS) : occupied[ccy];
+    bits &= (dir > 0) ? ~((2u << ccx) - 1) : ((1u << ccx) - 1);
+    if (bits != 0) {
+        *y = ccy;
+        *x = (dir > 0) ? __builtin_ctz(bits) : 31 - __builtin_clz(bits);
+        return true;
+    }
+
+    // then the closest row with a match, wrapping back to the current one
+    unsigned int other = rows & ((dir > 0) ? ~((2u << ccy) - 1) : ((1u << ccy) - 1));
+    if (other == 0)
+        other = rows;
+    *y = (dir > 0) ? __builtin_ctz(other) : 31 - __builtin_clz(other);
+    bits = empty ? (~occupied[*y] & ALLCOLS) : occupied[*y];
+    *x = (dir > 0) ? __builtin_ctz(bits) : 31 - __builtin_clz(bits);
+    return true;
+}
+
+void
+goto_cell(int y, int x)
+{
+    ccy = y;
+    ccx = x;
+
+    dirty |= DirtyView;
+}
+
+void
+view_column(const Arg *arg)
+{
+    if (arg->i <= COLS)
+        goto_cell(ccy, arg->i);
+}
+
+void
+step_column(const Arg *arg)
+{
+    goto_cell(ccy, clip(ccx + arg->i, COLS));
+}
+
+void
+step_row(const Arg *arg)
+{
+    goto_cell(clip(ccy + arg->i, ROWS), ccx);
+}
+
+void
+view_previous(const Arg *arg)
+{
+    goto_cell(pcy, pcx);
+}
+
+void
+goto_occupied(const Arg *arg)
+{
+    int y, x;
+    if (find_cell(false, arg->i, &y, &x))
+        goto_cell(y, x);
+}
+
+// first occupied cell of the next row holding any
+void
+goto_occupied_row(const Arg *arg)
+{
+    unsigned int rows = rows_occupied & ~((2u << ccy) - 1);
+    if (rows == 0)
+        rows = rows_occupied;
+    if (rows == 0)
+        return;
+
+    int y = __builtin_ctz(rows);
+    goto_cell(y, __builtin_ctz(occupied[y]));
+}
+
+// somewhere to put down the hand
+void
+goto_empty(const Arg *arg)
+{
+    int y, x;
+    if (find_cell(true, 1, &y, &x))
+        goto_cell(y, x);
+}
+
+void
+kill_client(const Arg *arg)
+{
+    Client *c = cells[ccy][ccx].slots[0];
+    // TODO: lookup the focused client in a better way than this
+    // cannot kill secondary window with this logic
+    if (c != NULL) {
+        // it may take its time to go, or not go at all
+        unpark(c);
+        emit(OpClose, c, 0, 0, 0, 0);
+
+        // remove this from the list of clients
+        forget_client(c);
+    }
+}
+
+void
+set_layout(const Arg *arg)
+{
+    cells[ccy][ccx].layout = arg->i;
+    dirty |= DirtyLayout;
+}
+
+// flip entries in the cell, the primary goes last and the rest move up
+void
+flip_cell(const Arg *arg)
+{
+    Cell *curr = &cells[ccy][ccx];
+    Client *tmp = curr->slots[0];
+    for (int s = 0; s < SLOTS - 1; s++)
+        curr->slots[s] = curr->slots[s + 1];
+    curr->slots[SLOTS - 1] = tmp;
+    dirty |= DirtyLayout;
+}
+
+void
+place_hand(const Arg *arg)
+{
+    if (nhand == 0)
+        return;
+
+    // nothing we can do from here
+    int slot = free_slot(&cells[ccy][ccx]);
+    if (slot < 0)
+        return;
+
+    // free up the hand and place it in
+    Client *top = &pool[hand_top];
+    remove_hand(top);
+    put_client(top, ccy, ccx, slot);
+
+    dirty |= DirtyLayout;
+}
+
+void
+pickup_hand(const Arg *arg)
+{
+    Cell *c = &cells[ccy][ccx];
+    // nothing to pick up
+    if (c->slots[0] == NULL)
+        return;
+
+    // Push a new entry into hand
+    push_hand(c->slots[0]);
+
+    // the window drops out of the view on the next frame
+    c->slots[0] = NULL;
+    update_occupancy(ccy, ccx);
+
+    dirty |= DirtyLayout;
+}
+
+void
+configure_client(Client *c, int x, int y, int w, int h)
+{
+    // nothing moved, nothing to tell the server
+    if ((c->x == x) && (c->y == y) && (c->w == w) && (c->h == h))
+        return;
+
+    emit(OpMove, c, x, y, w, h);
+    c->x = x; c->y = y;
+    c->w = w; c->h = h;
+}
+
+void
+update_cell_layout()
+{
+    Cell* cell = &cells[ccy][ccx];
+    int x = viewport.x, y = viewport.y, w = viewport.w, h = viewport.h;
+
+    // a tile per slot, the last one takes what is left of the division
+    for (int s = 0; s < SLOTS; s++) {
+        if (cell->slots[s] == NULL)
+            continue;
+        if (cell->layout == Tiled)
+            configure_client(cell->slots[s], x + s * (w / SLOTS), y,
+                             (s == SLOTS - 1) ? w - s * (w / SLOTS) : w / SLOTS, h);
+        else
+            configure_client(cell->slots[s], x, y, w, h);
+    }
+}
+
+// move a cell to the front of the hot list, or off it with front false,
+// unmapping the parked windows of a cell that falls off the end
+void
+touch_hot(int y, int x, bool front)
+{
+    int id = y * (COLS + 1) + x, i = 0;
+    while ((i < nhot) && (hot[i] != id))
+        i++;
+    if (i < nhot) {
+        nhot--;
+        memmove(&hot[i], &hot[i + 1], (nhot - i) * sizeof(hot[0]));
+    }
+    if (!front)
+        return;
+
+    memmove(&hot[1], &hot[0], nhot * sizeof(hot[0]));
+    hot[0] = id;
+    if (++nhot <= HOTCELLS)
+        return;
+
+    nhot--;
+    Cell *cold = &cells[hot[nhot] / (COLS + 1)][hot[nhot] % (COLS + 1)];
+    for (int s = 0; s < SLOTS; s++)
+        if (cold->slots[s] != NULL)
+            unpark(cold->slots[s]);
+}
+
+bool
+is_hot(int y, int x)
+{
+    for (int i = 0; i < nhot; i++)
+        if (hot[i] == y * (COLS + 1) + x)
+            return true;
+    return false;
+}
+
+bool
+shown_in(unsigned long w, unsigned long wins[SLOTS])
+{
+    for (int s = 0; s < SLOTS; s++)
+        if (wins[s] == w)
+            return true;
+    return false;
+}
+
+void
+update_view()
+{
+    // the previous cell is the one last shown, not one passed over by
+    // moves coalesced into this frame
+    if ((viewy != ccy) || (viewx != ccx)) {
+        if (viewy != 0) {
+            touch_hot(viewy, viewx, true);
+            pcy = viewy;
+            pcx = viewx;
+        }
+        touch_hot(ccy, ccx, false);
+    }
+
+    // the current cell's window(s)
+    Cell* curr = &cells[ccy][ccx];
+    Client* want[SLOTS] = { NULL };
+    unsigned long wantwin[SLOTS] = { 0 };
+    for (int s = 0; s < SLOTS; s++) {
+        if (curr->slots[s] == NULL)
+            continue;
+        if (curr->layout == Tiled) {
+            want[s] = curr->slots[s];
+        } else {
+            // only display one window in Monocle
+            want[0] = curr->slots[s];
+            break;
+        }
+    }
+    for (int s = 0; s < SLOTS; s++)
+        wantwin[s] = want[s] ? want[s]->win : 0;
+
+    // windows of this cell parked when it was left and not shown now, eg
+    // flipped away from in the same frame, would stay on screen off to
+    // the side
+    for (int s = 0; s < SLOTS; s++)
+        if ((curr->slots[s] != NULL) && !shown_in(curr->slots[s]->win, wantwin))
+            unpark(curr->slots[s]);
+
+    // windows shown previously go, unless they stay, to be parked
+    // off-screen if their cell is hot
+    for (int i = 0; i < SLOTS; i++) {
+        if ((mapped[i] == 0) || shown_in(mapped[i], wantwin))
+            continue;
+        Client *c = find_client(mapped[i]);
+        if (c == NULL)
+            continue;
+        if ((c->cy > 0) && is_hot(c->cy, c->cx)) {
+            configure_client(c, viewport.x + viewport.w, c->y, c->w, c->h);
+            c->parked = true;
+        } else {
+            emit(OpUnmap, c, 0, 0, 0, 0);
+        }
+    }
+    // a parked window is back in place by now, the layout moved it
+    for (int i = 0; i < SLOTS; i++) {
+        if ((want[i] == NULL) || shown_in(wantwin[i], mapped))
+            continue;
+        if (want[i]->parked)
+            want[i]->parked = false;
+        else
+            emit(OpMap, want[i], 0, 0, 0, 0);
+    }
+    memcpy(mapped, wantwin, sizeof(mapped));
+    viewy = ccy;
+    viewx = ccx;
+}
+
+// take the windows of the current cell off the screen, the next view
+// update brings them back
+void
+hide_view()
+{
+    for (unsigned int m = 0; m < LENGTH(mapped); m++)
+        if (mapped[m] != 0) {
+            Client *c = find_client(mapped[m]);
+            if (c != NULL)
+                emit(OpUnmap, c, 0, 0, 0, 0);
+            mapped[m] = 0;
+        }
+}
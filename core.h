@@ -0,0 +1,166 @@
+// the grid, the hand and the view, kept apart from X so they can be driven
+// and measured on their own: actions change the state and mark it dirty,
+// update_view and update_cell_layout turn that into X operations queued in
+// ops, which the backend in wm.c carries out once per frame
+
+#include <stdbool.h>
+
+#define LENGTH(X) (sizeof (X) / sizeof (X)[0])
+
+// size of the grid and windows per cell, every loop over them is bounded
+// by these, rows and columns fit the occupancy bitmasks
+#define ROWS 9
+#define COLS 9
+#define SLOTS 2
+
+#if (ROWS > 30) || (COLS > 30) || (SLOTS < 1)
+#error "grid must be at most 30x30 with at least one slot per cell"
+#endif
+
+// recently left cells kept mapped off-screen, switching back to one is a
+// move instead of a map, 0 unmaps every cell as soon as it is left
+#define HOTCELLS 3
+
+// clients live in a fixed pool, handed out from the bottom up with freed
+// slots reused first, so the map/destroy path never calls the allocator
+// a power of two, with room for a full grid and as much again in hand
+#define MAXCLIENTS 1024
+
+#if ROWS * COLS * SLOTS > MAXCLIENTS / 2
+#error "grid holds more windows than the pool, raise MAXCLIENTS"
+#endif
+
+// Monocle shows the first window of a cell full size, Tiled all of its
+// slots side by side, SLOTS tiles across
+enum Layout {
+    Monocle,
+    Tiled
+};
+
+// argument of an action bound to a key
+typedef union {
+    int i;
+    const void *v;
+} Arg;
+
+// owned by the backend
+struct Title;
+
+typedef struct Client Client;
+struct Client
+{
+    int cx, cy;
+    unsigned long win;
+    struct Title* title;
+
+    // geometry last applied by us, w == 0 until first placed
+    int x, y, w, h;
+
+    // mapped, but moved off-screen with a hot cell
+    bool parked;
+
+    // neighbours in the hand as pool indices, -1 past either end
+    short above, below;
+};
+
+typedef struct Cell Cell;
+struct Cell
+{
+    enum Layout layout;
+
+    // slots[0] is the primary window
+    Client* slots[SLOTS];
+};
+
+// state changes are collected while events drain and applied once per
+// main loop iteration, see commit_frame
+enum Dirty {
+    DirtyLayout = 1 << 0,
+    DirtyView = 1 << 1,
+    DirtyBar = 1 << 2,
+    DirtyHand = 1 << 3,
+    DirtyOverview = 1 << 4
+};
+
+enum OpType {
+    OpMap,
+    OpUnmap,
+    // move and resize to x, y, w, h
+    OpMove,
+    // ask the client to close its window
+    OpClose,
+    // the client is gone, the backend lets go of its own data for it and
+    // hands the slot back with free_client
+    OpForget
+};
+
+typedef struct Op Op;
+struct Op
+{
+    enum OpType type;
+    Client *c;
+    unsigned long win;
+    int x, y, w, h;
+};
+
+extern Client pool[MAXCLIENTS];
+extern unsigned int nclients;
+
+// rows and columns count from 1
+extern Cell cells[ROWS + 1][COLS + 1];
+
+// occupancy of the grid as bitmasks, bit x of occupied[y] is set when cell
+// (y, x) holds a window, bit y of the row masks when any/all of row y does
+#define ALLCOLS ((2u << COLS) - 2)
+#define ALLROWS ((2u << ROWS) - 2)
+extern unsigned int occupied[ROWS + 1];
+extern unsigned int rows_occupied, rows_full;
+
+extern int ccx, ccy, pcx, pcy;
+
+// the hand is a stack threaded through the pool, by index
+extern int hand_top, hand_bottom;
+extern unsigned int nhand;
+
+// windows currently mapped for the visible cell, and the cell they show
+extern unsigned long mapped[SLOTS];
+extern int viewy, viewx;
+
+extern unsigned int dirty;
+
+// X operations waiting for the backend, in order
+extern Op *ops;
+extern unsigned int nops;
+
+void set_viewport(int x, int y, int w, int h);
+
+Client* find_client(unsigned long w);
+Client* new_client(unsigned long w);
+void forget_client(Client *c);
+void free_client(Client *c);
+Client* client_mapped(unsigned long w);
+
+void push_hand(Client *c);
+void place_client(Client *c);
+bool put_client(Client *c, int y, int x, int slot);
+
+int clip(int n, int max);
+bool find_cell(bool empty, int dir, int *y, int *x);
+void goto_cell(int y, int x);
+
+void view_column(const Arg *arg);
+void step_column(const Arg *arg);
+void step_row(const Arg *arg);
+void view_previous(const Arg *arg);
+void goto_occupied(const Arg *arg);
+void goto_occupied_row(const Arg *arg);
+void goto_empty(const Arg *arg);
+void kill_client(const Arg *arg);
+void set_layout(const Arg *arg);
+void flip_cell(const Arg *arg);
+void place_hand(const Arg *arg);
+void pickup_hand(const Arg *arg);
+
+void update_cell_layout();
+void update_view();
+void hide_view();
@@ -5,12 +5,30 @@
 #include <X11/Xutil.h>
 #include <X11/cursorfont.h>
 #include <X11/Xft/Xft.h>
+#include <X11/extensions/Xrender.h>
+#include <X11/extensions/Xcomposite.h>
 #include <X11/Xatom.h>
+#include <xcb/xcb.h>
 #include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
 #include <sys/timerfd.h>
-#include <sys/select.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <linux/netlink.h>
 
-#define LENGTH(X) (sizeof (X) / sizeof (X)[0])
+#include "core.h"
+
+extern char **environ;
 
 enum ColorType {
     Black,
@@ -22,9 +40,31 @@ enum ColorType {
 };
 static char* colors[NumColors] = {"black", "white", "gray", "lightblue", "red"};
 
-enum Layout {
-    Monocle,
-    Tiled
+static char* termcmd[] = {"vex", NULL};
+static char* menucmd[] = {"dmenu_run", NULL};
+
+// the fixed alphabet of the bar, pre-rendered once for every color pair
+static const char sprite_chars[] = "0123456789[]M=*-%:, ";
+
+enum AtomType {
+    WMProtocols,
+    WMDelete,
+    NetWMName,
+    UTF8String,
+    NumAtoms
+};
+static char* atom_names[NumAtoms] = {"WM_PROTOCOLS", "WM_DELETE_WINDOW",
+                                     "_NET_WM_NAME", "UTF8_STRING"};
+
+enum BarSegment {
+    SegRow,
+    SegCells,
+    SegLayout,
+    SegSlots,
+    SegTitle,
+    SegBattery,
+    SegClock,
+    NumSegments
 };
 
 struct X11
@@ -34,55 +74,243 @@ struct X11
     int screen;
     Window root;
 
+    // second connection for property fetches, requests go out as cookies
+    // and replies are collected once per frame instead of a round trip each
+    xcb_connection_t *xcb;
+
     int sw, sh;
 
+    Atom atoms[NumAtoms];
+
     XftDraw* fdraw;
     XftColor colors[NumColors];
+    GC gc;
+
+    // bar is drawn off-screen and copied to the root window
+    Pixmap barbuf;
+    XftDraw* bdraw;
+    int segx[NumSegments + 1];
+
+    // sprite atlas, a row per fg/bg color pair and a column per glyph
+    Pixmap sprites;
+    XftDraw* sdraw;
+    int glyph_w;
+    signed char glyph_index[128];
+
     int font_width, font_height;
     XftFont* font;
+    int ellipsis_w;
 
+    // hand card, rendered off-screen when the hand changes
     Window handwin;
     int hx, hy, hw, hh;
+    Pixmap handbuf;
     XftDraw* hdraw;
+
+    // overview of the grid, thumbnails are kept in an atlas laid out like
+    // the overview itself, a box of bw x bh per cell
+    Window overwin;
+    XftDraw* odraw;
+    Pixmap thumbs;
+    Picture thumbpic, rootpic;
+    int bw, bh;
 };
 
 struct X11 x11;
 
-static int ccx = 1;
-static int ccy = 1;
-static int pcx = 1;
-static int pcy = 1;
+#define NSEC 1000000000LL
 
-typedef struct Client Client;
-struct Client
+int64_t
+now_ns()
 {
-    int cx, cy;
-    Window win;
-    char title[100];
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return (int64_t)ts.tv_sec * NSEC + ts.tv_nsec;
+}
 
-    Client *next;
+// latency histograms, log scale with 4 buckets per power of two, one per
+// X event type and one per action, dumped on SIGUSR1
+#define NBUCKETS (40 * 4)
+
+typedef struct Histogram Histogram;
+struct Histogram
+{
+    unsigned int count;
+    int64_t max;
+    unsigned int buckets[NBUCKETS];
 };
 
-Client* clients;
+enum StatAction {
+    StatFrame,
+    StatLayout,
+    StatView,
+    StatBar,
+    StatTimer,
+    NumStatActions
+};
+static const char* action_names[NumStatActions] = {"commit_frame", "update_cell_layout",
+                                                   "update_view", "draw_bar", "timer"};
+static const char* event_names[LASTEvent] = {
+    [KeyPress] = "KeyPress", [ConfigureRequest] = "ConfigureRequest",
+    [MapRequest] = "MapRequest", [DestroyNotify] = "DestroyNotify",
+    [Expose] = "Expose", [PropertyNotify] = "PropertyNotify",
+    [MappingNotify] = "MappingNotify"
+};
 
-typedef struct Hand Hand;
-struct Hand
+struct Stats
 {
-    Client *cl;
-    Hand* next;
+    Histogram events[LASTEvent];
+    Histogram actions[NumStatActions];
+
+    // xlib counts its own requests, xcb ones and the waits on their replies
+    // are ours, round trips xlib makes are not counted
+    unsigned long xcb_requests;
+    unsigned long xcb_round_trips;
 };
-Hand* hand;
+struct Stats stats;
+
+void
+record(Histogram *h, int64_t start)
+{
+    int64_t ns = now_ns() - start;
+    int b = 0;
+    if (ns >= 4) {
+        int log = 63 - __builtin_clzll(ns);
+        b = (log - 1) * 4 + ((ns >> (log - 2)) & 3);
+    } else if (ns > 0) {
+        b = ns;
+    }
+    if (b >= NBUCKETS)
+        b = NBUCKETS - 1;
+
+    h->buckets[b]++;
+    h->count++;
+    if (ns > h->max)
+        h->max = ns;
+}
+
+// upper bound of the bucket holding the q-th fraction of samples, in us
+double
+percentile(Histogram *h, double q)
+{
+    unsigned int want = q * h->count, seen = 0;
+    int b = 0;
+    for (; b < NBUCKETS - 1; b++) {
+        seen += h->buckets[b];
+        if (seen > want)
+            break;
+    }
+    int64_t bound = b + 1;
+    if (b >= 4)
+        bound = (int64_t)(5 + b % 4) << (b / 4 - 1);
+    return ((bound < h->max) ? bound : h->max) / 1000.0;
+}
+
+void
+dump_histogram(FILE *f, const char *name, Histogram *h)
+{
+    if (h->count == 0)
+        return;
+    fprintf(f, "%s %u %.1f %.1f %.1f %.1f\n", name, h->count,
+            percentile(h, 0.5), percentile(h, 0.9), percentile(h, 0.99),
+            h->max / 1000.0);
+}
+
+// per display file in the runtime dir, so an instance on another display,
+// eg, the benchmark under Xvfb, leaves the ones of the session alone
+void
+runtime_path(char *path, size_t n, const char *suffix)
+{
+    char disp[64];
+    snprintf(disp, sizeof(disp), "%s", DisplayString(x11.dpy));
+    for (char *c = disp; *c; c++)
+        if (*c == '/')
+            *c = '_';
+
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (dir != NULL)
+        snprintf(path, n, "%s/cellwm-%s%s", dir, disp, suffix);
+    else
+        snprintf(path, n, "/tmp/cellwm-%d-%s%s", (int)getuid(), disp, suffix);
+}
 
-typedef struct Cell Cell;
-struct Cell
+void
+dump_stats(Display *dpy)
 {
-    enum Layout layout;
+    // written aside and renamed, a reader never sees half a dump
+    char path[512], tmp[520];
+    runtime_path(path, sizeof(path), "-stats");
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *f = fopen(tmp, "w");
+    if (f == NULL)
+        return;
+
+    fprintf(f, "xlib_requests %lu\n", NextRequest(dpy) - 1);
+    fprintf(f, "xcb_requests %lu\n", stats.xcb_requests);
+    fprintf(f, "xcb_round_trips %lu\n", stats.xcb_round_trips);
+    fprintf(f, "# name count p50_us p90_us p99_us max_us\n");
+    for (int i = 0; i < LASTEvent; i++) {
+        char name[16];
+        if (event_names[i] == NULL)
+            snprintf(name, sizeof(name), "event%d", i);
+        dump_histogram(f, event_names[i] ? event_names[i] : name, &stats.events[i]);
+    }
+    for (int i = 0; i < NumStatActions; i++)
+        dump_histogram(f, action_names[i], &stats.actions[i]);
+
+    fclose(f);
+    rename(tmp, path);
+}
+
+// interned, reference counted window titles, equal titles share an entry
+// so a title is unchanged exactly when its pointer is
+#define NFITS 4
 
-    Client* primary;
-    Client* secondary;
+typedef struct Title Title;
+struct Title
+{
+    unsigned int ref, hash;
+    int len;
+    Title *next;
+
+    // layout cache, the full width in pixels, -1 until measured, and the
+    // last few widths it had to be cut down to, see fit_title
+    int width;
+    unsigned int nfits;
+    struct {
+        short avail, len, w;
+    } fits[NFITS];
+
+    char s[];
 };
+Title* title_store[256];
+
+// longest title we fetch, in bytes
+#define MAXTITLE 256
 
-Cell cells[9][9];
+// marks a title cut short
+#define ELLIPSIS "\xe2\x80\xa6"
+
+// a title request still in flight, both properties are asked for at once
+typedef struct TitleReq TitleReq;
+struct TitleReq
+{
+    Client *c;
+    xcb_get_property_cookie_t net_name_req, name_req;
+};
+TitleReq title_queue[MAXCLIENTS];
+unsigned int ntitles;
+
+// while the overview is up, the view is left alone and only the overview
+// follows the current cell
+bool overview;
+// view and layout changes held back while the overview is up
+unsigned int held;
+// cells with a thumbnail in the atlas, one bit per cell like occupied
+unsigned int thumbed[ROWS + 1];
+// whether the thumbnail of the cell on screen was taken since it came up
+bool captured;
 
 enum TimerState {
     OFF,
@@ -91,44 +319,185 @@ enum TimerState {
 };
 enum TimerState timer = OFF;
 int timer_dur = 20*60;
-int timer_elapsed = 0;
+int64_t timer_start;
 
 int cellh = 22 + 10;
 
-void
-delete_client(Client* cl)
+// characters in a row or column number, for the bar
+#define DIGITS(n) (((n) > 9) ? 2 : 1)
+
+// contents of the bar, drawn into barbuf one segment at a time
+// only segments whose contents differ from what is shown get redrawn
+typedef struct BarState BarState;
+struct BarState
 {
-    // first entry
-    if (clients == cl) {
-        clients = cl->next;
-    } else {
-        Client *p = clients;
-        for (Client *c = clients->next; c; c = c->next) {
-            if (c == cl) {
-                p->next = c->next;
-                break;
-            }
-            p = c;
+    int row;
+    char cells[COLS];
+    char layout;
+    char indicator[SLOTS];
+    // titles of the windows on screen, one per tile
+    Title* titles[SLOTS];
+    int bat, ac;
+    char clock[20];
+    int timer_fill;
+    bool timer_ack;
+};
+BarState bar, shown;
+
+Title*
+intern_title(const char *s, int len)
+{
+    // fnv-1a
+    unsigned int hash = 2166136261u;
+    for (int i = 0; i < len; i++)
+        hash = (hash ^ (unsigned char)s[i]) * 16777619u;
+
+    Title **bucket = &title_store[hash % LENGTH(title_store)];
+    for (Title *t = *bucket; t; t = t->next)
+        if ((t->hash == hash) && (t->len == len) && !memcmp(t->s, s, len)) {
+            t->ref++;
+            return t;
         }
+
+    Title *t = (Title*)malloc(sizeof(Title) + len + 1);
+    t->ref = 1;
+    t->hash = hash;
+    t->len = len;
+    t->width = -1;
+    t->nfits = 0;
+    memcpy(t->s, s, len);
+    t->s[len] = '\0';
+    t->next = *bucket;
+    *bucket = t;
+    return t;
+}
+
+Title*
+retain_title(Title *t)
+{
+    if (t != NULL)
+        t->ref++;
+    return t;
+}
+
+void
+release_title(Title *t)
+{
+    if ((t == NULL) || (--t->ref > 0))
+        return;
+
+    Title **p = &title_store[t->hash % LENGTH(title_store)];
+    while (*p != t)
+        p = &(*p)->next;
+    *p = t->next;
+    free(t);
+}
+
+TitleReq*
+queued_title(Client *c)
+{
+    for (unsigned int t = 0; t < ntitles; t++)
+        if (title_queue[t].c == c)
+            return &title_queue[t];
+    return NULL;
+}
+
+// forget a request in flight, its replies are never read
+void
+drop_title(TitleReq *r)
+{
+    xcb_discard_reply(x11.xcb, r->net_name_req.sequence);
+    xcb_discard_reply(x11.xcb, r->name_req.sequence);
+    *r = title_queue[--ntitles];
+}
+
+void
+request_title(Client *c)
+{
+    // a newer change supersedes a request still in flight
+    TitleReq *r = queued_title(c);
+    if (r != NULL)
+        drop_title(r);
+
+    r = &title_queue[ntitles++];
+    r->c = c;
+    r->net_name_req = xcb_get_property(x11.xcb, 0, c->win, x11.atoms[NetWMName],
+                                       x11.atoms[UTF8String], 0, MAXTITLE / 4);
+    r->name_req = xcb_get_property(x11.xcb, 0, c->win, XCB_ATOM_WM_NAME,
+                                   XCB_ATOM_STRING, 0, MAXTITLE / 4);
+    stats.xcb_requests += 2;
+}
+
+xcb_get_property_reply_t*
+title_reply(xcb_get_property_cookie_t req, Atom type)
+{
+    xcb_generic_error_t *err = NULL;
+    xcb_get_property_reply_t *r = xcb_get_property_reply(x11.xcb, req, &err);
+    free(err);
+    if ((r != NULL) && ((r->type != type) || (r->format != 8) ||
+                        (xcb_get_property_value_length(r) == 0))) {
+        free(r);
+        r = NULL;
     }
-    free(cl);
+    return r;
 }
 
 void
-get_title(Client *c)
+get_title(TitleReq *r)
 {
-    // fallback option
-    memcpy(c->title, "unknown", 7);
-    c->title[7] = '\0';
+    Client *c = r->c;
+
+    // prefer the utf8 name, fall back to the latin-1 WM_NAME
+    xcb_get_property_reply_t *net_name = title_reply(r->net_name_req, x11.atoms[UTF8String]);
+    xcb_get_property_reply_t *name = title_reply(r->name_req, XA_STRING);
+
+    char buf[2 * MAXTITLE];
+    int len = 0;
+    if (net_name != NULL) {
+        len = xcb_get_property_value_length(net_name);
+        if (len > MAXTITLE)
+            len = MAXTITLE;
+        memcpy(buf, xcb_get_property_value(net_name), len);
+        // do not leave a cut sequence at the end
+        if ((len == MAXTITLE) && (buf[len - 1] & 0x80))
+            while ((len > 0) && ((buf[--len] & 0xC0) == 0x80));
+    } else if (name != NULL) {
+        unsigned char *src = xcb_get_property_value(name);
+        int n = xcb_get_property_value_length(name);
+        for (int i = 0; (i < n) && (i < MAXTITLE); i++) {
+            if (src[i] < 0x80) {
+                buf[len++] = src[i];
+            } else {
+                buf[len++] = 0xC0 | (src[i] >> 6);
+                buf[len++] = 0x80 | (src[i] & 0x3F);
+            }
+        }
+    }
+    free(net_name);
+    free(name);
 
-	XTextProperty name;
-	if (!XGetTextProperty(x11.dpy, c->win, &name, XA_WM_NAME))
+    // keep the old title when the window has none
+    if (len == 0)
         return;
 
-	if (name.encoding == XA_STRING) {
-		memcpy(c->title, (char *)name.value, 99);
-        c->title[100] = '\0';
-    }
+    Title *t = intern_title(buf, len);
+    release_title(c->title);
+    c->title = t;
+
+    // the hand card shows titles too
+    if (c->cx == -1)
+        dirty |= DirtyHand;
+}
+
+void
+collect_titles()
+{
+    // only the first reply can block, the rest are in by then
+    if (ntitles > 0)
+        stats.xcb_round_trips++;
+    for (unsigned int t = 0; t < ntitles; t++)
+        get_title(&title_queue[t]);
+    ntitles = 0;
 }
 
 bool
@@ -163,9 +532,25 @@ x11_setup(struct X11 *x11)
     x11->screen = DefaultScreen(x11->dpy);
     x11->root = XDefaultRootWindow(x11->dpy);
     x11->fd = ConnectionNumber(x11->dpy);
+    fcntl(x11->fd, F_SETFD, FD_CLOEXEC);
     x11->sw = DisplayWidth(x11->dpy, x11->screen);
     x11->sh = DisplayHeight(x11->dpy, x11->screen);
 
+    x11->xcb = xcb_connect(NULL, NULL);
+    if (xcb_connection_has_error(x11->xcb))
+    {
+        fprintf(stderr, "Cannot open xcb connection\n");
+        return false;
+    }
+    fcntl(xcb_get_file_descriptor(x11->xcb), F_SETFD, FD_CLOEXEC);
+
+    // resolve all atoms in a single round trip
+    if (!XInternAtoms(x11->dpy, atom_names, NumAtoms, False, x11->atoms))
+    {
+        fprintf(stderr, "Could not intern atoms\n");
+        return false;
+    }
+
     int cw = 150, ch = 250;
     x11->hx = x11->sw/2 - cw/2; x11->hy = x11->sh - ch - 100;
     x11->hw = cw; x11->hh = ch;
@@ -173,24 +558,15 @@ x11_setup(struct X11 *x11)
                                         x11->hx, x11->hy, x11->hw, x11->hh,
                                         2, BlackPixel(x11->dpy, x11->screen),
                                         WhitePixel(x11->dpy, x11->screen));
+    XSelectInput(x11->dpy, x11->handwin, ExposureMask);
 
+    XSelectInput(x11->dpy, x11->root, SubstructureRedirectMask | SubstructureNotifyMask | ExposureMask);
 
-    // little trick lifted from dwm
-    unsigned int modifiers[] = { 0, LockMask, Mod2Mask, Mod2Mask|LockMask };
-
-    KeySym syms[] = { XK_Return, XK_p, XK_Left, XK_Right, XK_Up, XK_Down, XK_Tab,
-                      XK_k, XK_m, XK_t, XK_f, XK_i, XK_l, XK_u, XK_End};
-    KeySym numsyms[] = {XK_1, XK_2, XK_3, XK_4, XK_5, XK_6, XK_7, XK_8, XK_9};
-
-    for (unsigned int j = 0; j < LENGTH(modifiers); j++) {
-        for (unsigned int k = 0; k < LENGTH(syms); k++)
-            XGrabKey(x11->dpy, XKeysymToKeycode(x11->dpy, syms[k]), modifiers[j] | Mod1Mask, x11->root, False, GrabModeAsync, GrabModeAsync);
-        // bind the num keys with shift mask to deal with inverted number row
-        for (unsigned int k = 0; k < LENGTH(numsyms); k++)
-            XGrabKey(x11->dpy, XKeysymToKeycode(x11->dpy, numsyms[k]), modifiers[j] | Mod1Mask | ShiftMask, x11->root, False, GrabModeAsync, GrabModeAsync);
-    }
-
-    XSelectInput(x11->dpy, x11->root, SubstructureRedirectMask | SubstructureNotifyMask);
+    // parked windows keep their contents off-screen in a pixmap of their own
+    // so coming back needs no repaint, the server still draws them itself
+    int ev, err;
+    if ((HOTCELLS > 0) && XCompositeQueryExtension(x11->dpy, &ev, &err))
+        XCompositeRedirectSubwindows(x11->dpy, x11->root, CompositeRedirectAutomatic);
 
     Cursor cursor = XCreateFontCursor(x11->dpy, XC_left_ptr);
     XDefineCursor(x11->dpy, x11->root, cursor);
@@ -202,7 +578,9 @@ x11_setup(struct X11 *x11)
     x11->fdraw = XftDrawCreate(x11->dpy, x11->root,
                                DefaultVisual(x11->dpy, x11->screen),
                                DefaultColormap(x11->dpy, x11->screen));
-    x11->hdraw = XftDrawCreate(x11->dpy, x11->handwin,
+    x11->handbuf = XCreatePixmap(x11->dpy, x11->root, x11->hw, x11->hh,
+                                 DefaultDepth(x11->dpy, x11->screen));
+    x11->hdraw = XftDrawCreate(x11->dpy, x11->handbuf,
                                DefaultVisual(x11->dpy, x11->screen),
                                DefaultColormap(x11->dpy, x11->screen));
     if ((x11->fdraw == NULL) || (x11->hdraw == NULL))
@@ -222,351 +600,1120 @@ x11_setup(struct X11 *x11)
     XGlyphInfo ext;
     XftTextExtents8(x11->dpy, x11->font, (FcChar8 *)"m", 1, &ext);
     x11->font_width = ext.width + 2;
+    XftTextExtentsUtf8(x11->dpy, x11->font, (FcChar8 *)ELLIPSIS, strlen(ELLIPSIS), &ext);
+    x11->ellipsis_w = ext.xOff;
+
+    // lay out the bar segments, left to right
+    int fw = x11->font_width;
+    x11->segx[SegRow] = 0;
+    x11->segx[SegCells] = (2 + DIGITS(ROWS))*fw + 4;
+    x11->segx[SegLayout] = x11->segx[SegCells] + COLS*(DIGITS(COLS)*fw + 8);
+    x11->segx[SegSlots] = x11->segx[SegLayout] + fw + 13;
+    x11->segx[SegTitle] = x11->segx[SegSlots] + SLOTS*fw + 16;
+    x11->segx[SegBattery] = x11->sw - 24*fw;
+    x11->segx[SegClock] = x11->sw - 19*fw;
+    x11->segx[NumSegments] = x11->sw;
+
+    x11->barbuf = XCreatePixmap(x11->dpy, x11->root, x11->sw, cellh,
+                                DefaultDepth(x11->dpy, x11->screen));
+    x11->bdraw = XftDrawCreate(x11->dpy, x11->barbuf,
+                               DefaultVisual(x11->dpy, x11->screen),
+                               DefaultColormap(x11->dpy, x11->screen));
+    if (x11->bdraw == NULL)
+    {
+        fprintf(stderr, "Could not create xft draw \n");
+        return false;
+    }
+    XftDrawRect(x11->bdraw, &x11->colors[White], 0, 0, x11->sw, cellh);
+
+    // pre-render the sprites
+    int nglyphs = LENGTH(sprite_chars) - 1;
+    x11->glyph_w = x11->font->max_advance_width;
+    x11->sprites = XCreatePixmap(x11->dpy, x11->root,
+                                 nglyphs * x11->glyph_w, NumColors * NumColors * cellh,
+                                 DefaultDepth(x11->dpy, x11->screen));
+    x11->sdraw = XftDrawCreate(x11->dpy, x11->sprites,
+                               DefaultVisual(x11->dpy, x11->screen),
+                               DefaultColormap(x11->dpy, x11->screen));
+    if (x11->sdraw == NULL)
+    {
+        fprintf(stderr, "Could not create xft draw \n");
+        return false;
+    }
+    memset(x11->glyph_index, -1, sizeof(x11->glyph_index));
+    for (int g = 0; g < nglyphs; g++)
+        x11->glyph_index[(int)sprite_chars[g]] = g;
+    for (int fg = 0; fg < NumColors; fg++)
+        for (int bg = 0; bg < NumColors; bg++) {
+            if (fg == bg)
+                continue;
+            int y = (fg * NumColors + bg) * cellh;
+            XftDrawRect(x11->sdraw, &x11->colors[bg], 0, y, nglyphs * x11->glyph_w, cellh);
+            for (int g = 0; g < nglyphs; g++)
+                XftDrawString8(x11->sdraw, &x11->colors[fg], x11->font,
+                            g * x11->glyph_w, y + cellh - 5,
+                            (XftChar8 *)&sprite_chars[g], 1);
+        }
+
+    XGCValues gcv;
+    gcv.graphics_exposures = False;
+    x11->gc = XCreateGC(x11->dpy, x11->root, GCGraphicsExposures, &gcv);
+
+    // the overview covers everything below the bar
+    int vh = x11->sh - cellh;
+    x11->bw = x11->sw / COLS;
+    x11->bh = vh / ROWS;
+    XSetWindowAttributes wa;
+    wa.override_redirect = True;
+    wa.background_pixel = WhitePixel(x11->dpy, x11->screen);
+    wa.event_mask = ExposureMask;
+    x11->overwin = XCreateWindow(x11->dpy, x11->root, 0, cellh, x11->sw, vh, 0,
+                                 CopyFromParent, InputOutput, CopyFromParent,
+                                 CWOverrideRedirect | CWBackPixel | CWEventMask, &wa);
+    x11->odraw = XftDrawCreate(x11->dpy, x11->overwin,
+                               DefaultVisual(x11->dpy, x11->screen),
+                               DefaultColormap(x11->dpy, x11->screen));
+    x11->thumbs = XCreatePixmap(x11->dpy, x11->root, x11->sw, vh,
+                                DefaultDepth(x11->dpy, x11->screen));
+    XRenderPictFormat *fmt = XRenderFindVisualFormat(x11->dpy,
+                                                     DefaultVisual(x11->dpy, x11->screen));
+    x11->thumbpic = XRenderCreatePicture(x11->dpy, x11->thumbs, fmt, 0, NULL);
+    // thumbnails are inset within their box, the rest shows as is
+    XRenderColor white = { 0xffff, 0xffff, 0xffff, 0xffff };
+    XRenderFillRectangle(x11->dpy, PictOpSrc, x11->thumbpic, &white, 0, 0, x11->sw, vh);
+
+    // the viewport is read through the root, scaled down to a thumbnail
+    // by the transform, so taking one is a single composite
+    XRenderPictureAttributes pa;
+    pa.subwindow_mode = IncludeInferiors;
+    x11->rootpic = XRenderCreatePicture(x11->dpy, x11->root, fmt, CPSubwindowMode, &pa);
+    double sx = (double)x11->sw / (x11->bw - 8), sy = (double)vh / (x11->bh - 8);
+    XTransform xf = {{
+        { XDoubleToFixed(sx), 0, 0 },
+        { 0, XDoubleToFixed(sy), XDoubleToFixed(cellh) },
+        { 0, 0, XDoubleToFixed(1) }
+    }};
+    XRenderSetPictureTransform(x11->dpy, x11->rootpic, &xf);
+    XRenderSetPictureFilter(x11->dpy, x11->rootpic, FilterBilinear, NULL, 0);
+    if (x11->odraw == NULL)
+    {
+        fprintf(stderr, "Could not create xft draw \n");
+        return false;
+    }
 
     XSync(x11->dpy, False);
     return true;
 }
 
+// bytes of a title that fit in avail pixels, leaving room for an ellipsis
+// when it has to be cut, with the width of that prefix in pw
+// measured once per title and width, redraws only look it up
+int
+fit_title(Title *t, int avail, int *pw)
+{
+    XGlyphInfo ext;
+    if (t->width < 0) {
+        XftTextExtentsUtf8(x11.dpy, x11.font, (FcChar8 *)t->s, t->len, &ext);
+        t->width = ext.xOff;
+    }
+    if (t->width <= avail) {
+        *pw = t->width;
+        return t->len;
+    }
+
+    unsigned int n = (t->nfits < NFITS) ? t->nfits : NFITS;
+    for (unsigned int i = 0; i < n; i++)
+        if (t->fits[i].avail == avail) {
+            *pw = t->fits[i].w;
+            return t->fits[i].len;
+        }
+
+    // binary search over the character boundaries for the longest prefix
+    // that still fits
+    int bounds[2 * MAXTITLE + 1], nb = 1;
+    bounds[0] = 0;
+    for (int i = 1; i < t->len; i++)
+        if ((t->s[i] & 0xC0) != 0x80)
+            bounds[nb++] = i;
+    int room = avail - x11.ellipsis_w;
+    int lo = 0, hi = nb - 1, lw = 0;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        XftTextExtentsUtf8(x11.dpy, x11.font, (FcChar8 *)t->s, bounds[mid], &ext);
+        if (ext.xOff <= room) {
+            lo = mid;
+            lw = ext.xOff;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    unsigned int slot = t->nfits++ % NFITS;
+    t->fits[slot].avail = avail;
+    t->fits[slot].len = bounds[lo];
+    t->fits[slot].w = lw;
+    *pw = lw;
+    return bounds[lo];
+}
+
+// draw a title in at most avail pixels, ellipsised when it does not fit
+void
+draw_title(XftDraw *d, enum ColorType fg, int x, int y, Title *t, int avail)
+{
+    int pw, len = fit_title(t, avail, &pw);
+    XftDrawStringUtf8(d, &x11.colors[fg], x11.font, x, y, (FcChar8 *)t->s, len);
+    if (len < t->len)
+        XftDrawStringUtf8(d, &x11.colors[fg], x11.font, x + pw, y,
+                          (FcChar8 *)ELLIPSIS, strlen(ELLIPSIS));
+}
+
+// titles of the stack shown on the hand card, from the top
+#define HANDPREVIEW 4
+
 void
 draw_hand()
 {
-    if (hand == NULL)
+    if (nhand == 0)
       return;
 
-    XftDrawString8(x11.hdraw, &x11.colors[Black], x11.font,
-                    30, 30, (XftChar8 *)&hand->cl->title, 10);
-    // TODO: make this into a clearer sign, like borders/colors
-    if (hand->next != NULL)
-        XftDrawString8(x11.hdraw, &x11.colors[Black], x11.font,
-                        30, 60, "(more)", 20);
+    XftDrawRect(x11.hdraw, &x11.colors[White], 0, 0, x11.hw, x11.hh);
+
+    // the top of the stack in full black, the ones below it grayed out
+    int lh = x11.font_height + 6, c = hand_top;
+    for (int i = 0; (i < HANDPREVIEW) && (c >= 0); i++, c = pool[c].below) {
+        draw_title(x11.hdraw, (i == 0) ? Black : Gray, 10, 10 + x11.font->ascent + i * lh,
+                   pool[c].title, x11.hw - 20);
+        if (i == 0)
+            XftDrawRect(x11.hdraw, &x11.colors[LightBlue], 0, lh + 4, x11.hw, 2);
+    }
+
+    // size of the whole stack
+    if (nhand > 1) {
+        char count[16];
+        int n = snprintf(count, sizeof(count), "%u", nhand);
+        XftDrawRect(x11.hdraw, &x11.colors[Black], 0, x11.hh - lh, x11.hw, lh);
+        XftDrawString8(x11.hdraw, &x11.colors[White], x11.font,
+                       x11.hw - 10 - n * x11.font_width, x11.hh - 8,
+                       (FcChar8 *)count, n);
+    }
+
+    XCopyArea(x11.dpy, x11.handbuf, x11.handwin, x11.gc, 0, 0, x11.hw, x11.hh, 0, 0);
 }
 
 void
 update_hand()
 {
-    if (hand == NULL)
+    if (nhand == 0)
         XUnmapWindow(x11.dpy, x11.handwin);
     else
         XMapWindow(x11.dpy, x11.handwin);
 }
 
+// clip further drawing on the bar to a segment
 void
-draw_bar(struct X11 *x11)
+clip_segment(struct X11 *x11, int x, int w)
 {
-    XftDrawRect(x11->fdraw, &x11->colors[White], 0, 0, x11->sw - 30*x11->font_width, cellh);
+    XRectangle r = { x, 0, w, cellh };
+    XftDrawSetClipRectangles(x11->bdraw, 0, 0, &r, 1);
+}
 
-    char cell;
-    int xoff = 0;
+// clear a segment of the bar and clip further drawing to it
+void
+clear_segment(struct X11 *x11, int x, int w, enum ColorType color)
+{
+    clip_segment(x11, x, w);
+    XftDrawRect(x11->bdraw, &x11->colors[color], x, 0, w, cellh);
+}
 
-    char row[3] = "[0]";
-    row[1] = '0' + ccy;
-    XftDrawString8(x11->fdraw, &x11->colors[Black], x11->font,
-                xoff,
-                cellh - 5,
-                (XftChar8 *)&row, 3);
-    xoff += (x11->font_width*2);
+// draw text onto the bar from the sprite atlas, with the background
+// already in place, glyphs outside the atlas go through xft
+void
+draw_text(struct X11 *x11, int x, enum ColorType fg, enum ColorType bg,
+          const char *str, int len)
+{
+    Picture dst = XftDrawPicture(x11->bdraw);
+    Picture src = XftDrawPicture(x11->sdraw);
+    int y = (fg * NumColors + bg) * cellh;
+
+    for (int i = 0; i < len; i++, x += x11->glyph_w) {
+        unsigned char ch = str[i];
+        int g = (ch < 128) ? x11->glyph_index[ch] : -1;
+        if (g >= 0)
+            XRenderComposite(x11->dpy, PictOpSrc, src, None, dst,
+                             g * x11->glyph_w, y, 0, 0, x, 0, x11->glyph_w, cellh);
+        else
+            XftDrawString8(x11->bdraw, &x11->colors[fg], x11->font,
+                        x, cellh - 5, (XftChar8 *)&str[i], 1);
+    }
+}
 
-    for (int i = 1; i < 10; i++) {
-        cell = '0' + i;
-        xoff += (x11->font_width + 8);
+void
+draw_bar(struct X11 *x11)
+{
+    // lookup curr cell
+    Cell *cc = &cells[ccy][ccx];
 
+    bar.row = ccy;
+    for (int i = 1; i <= COLS; i++) {
         if (i == ccx)
-            XftDrawRect(x11->fdraw, &x11->colors[LightBlue], xoff-4, 0, 8+x11->font_width, cellh);
-        else if ((cells[ccy][i].primary != NULL) || (cells[ccy][i].secondary != NULL))
-            XftDrawRect(x11->fdraw, &x11->colors[Gray], xoff-4, 0, 8+x11->font_width, cellh);
-
-        XftDrawString8(x11->fdraw, &x11->colors[Black], x11->font,
-                    xoff,
-                    cellh - 5,
-                    (XftChar8 *)&cell, 1);
-    }
-    xoff += (x11->font_width + 8);
-
-    // draw layout
-    xoff += 5;
-    char layout = 'M';
-    if (cells[ccy][ccx].layout == Tiled)
-        layout = '=';
-
-    XftDrawRect(x11->fdraw, &x11->colors[Black], xoff-4, 0, 8+x11->font_width, cellh);
-    XftDrawString8(x11->fdraw, &x11->colors[White], x11->font,
-                xoff,
-                cellh - 5,
-                (XftChar8 *)&layout, 1);
-    xoff += (x11->font_width + 8);
+            bar.cells[i-1] = 'c';
+        else if (occupied[ccy] & (1u << i))
+            bar.cells[i-1] = 'o';
+        else
+            bar.cells[i-1] = ' ';
+    }
+    bar.layout = (cc->layout == Tiled) ? '=' : 'M';
+    // the primary title, and side by side with it the others when they show
+    for (int s = 0; s < SLOTS; s++) {
+        bar.indicator[s] = (cc->slots[s] != NULL) ? '*' : '-';
+        Title *title = (cc->slots[s] != NULL) && ((s == 0) || (cc->layout == Tiled)) ?
+                       cc->slots[s]->title : NULL;
+        if (title != bar.titles[s]) {
+            release_title(bar.titles[s]);
+            bar.titles[s] = retain_title(title);
+        }
+    }
 
-    // lookup curr cell
-    Cell *cc = &cells[ccy][ccx];
+    int fw = x11->font_width;
+    int *segx = x11->segx;
+    // damaged span of the pixmap, to be copied out
+    int x0 = x11->sw, x1 = 0;
 
-    // draw window presence indicator
-    char indicator[] = "--";
-    if (cc->primary != NULL) indicator[0] = '*';
-    if (cc->secondary != NULL) indicator[1] = '*';
+    // cells are tracked one by one, a cell switch only touches two of them
+    int cw = DIGITS(COLS)*fw + 8;
+    for (int i = 0; i < COLS; i++) {
+        if (bar.cells[i] == shown.cells[i])
+            continue;
 
-    XftDrawString8(x11->fdraw, &x11->colors[Black], x11->font,
-                xoff,
-                cellh - 5,
-                (XftChar8 *)&indicator, 2);
-    xoff += 2*(x11->font_width + 8);
+        int x = segx[SegCells] + i*cw;
+        enum ColorType bg = (bar.cells[i] == 'c') ? LightBlue :
+                            (bar.cells[i] == 'o') ? Gray : White;
+        char cell[4];
+        int n = snprintf(cell, sizeof(cell), "%d", i + 1);
+        clear_segment(x11, x, cw, bg);
+        draw_text(x11, x + 4, Black, bg, cell, n);
 
-    // draw title of primary window
-    if (cc->primary != NULL) {
-        XftDrawString8(x11->fdraw, &x11->colors[Black], x11->font,
-                    xoff,
-                    cellh - 5,
-                    (XftChar8 *)&cc->primary->title, strlen(cc->primary->title));
+        if (x < x0) x0 = x;
+        if (x + cw > x1) x1 = x + cw;
     }
-    // TODO: draw title of secondary window too?
-}
 
-void
-spawn(const char *cmd)
-{
-    if (!fork()) {
-        close(x11.fd);
-        system(cmd);
+    unsigned int dirty = 0;
+    if (bar.row != shown.row)
+        dirty |= 1 << SegRow;
+    if (bar.layout != shown.layout)
+        dirty |= 1 << SegLayout;
+    if (memcmp(bar.indicator, shown.indicator, SLOTS))
+        dirty |= 1 << SegSlots;
+    if (memcmp(bar.titles, shown.titles, sizeof(bar.titles)))
+        dirty |= 1 << SegTitle;
+    if ((bar.bat != shown.bat) || (bar.ac != shown.ac))
+        dirty |= 1 << SegBattery;
+    if (strcmp(bar.clock, shown.clock) || (bar.timer_fill != shown.timer_fill) ||
+        (bar.timer_ack != shown.timer_ack))
+        dirty |= 1 << SegClock;
+
+    for (int seg = 0; seg < NumSegments; seg++) {
+        if (!(dirty & (1 << seg)))
+            continue;
+
+        int x = segx[seg], w = segx[seg + 1] - segx[seg];
+        if (x < x0) x0 = x;
+        if (x + w > x1) x1 = x + w;
+
+        switch (seg) {
+            case SegRow:
+                clear_segment(x11, x, w, White);
+                char row[8];
+                int n = snprintf(row, sizeof(row), "[%d]", bar.row);
+                draw_text(x11, x, Black, White, row, n);
+                break;
+            case SegLayout:
+                clear_segment(x11, x, w, White);
+                XftDrawRect(x11->bdraw, &x11->colors[Black], x + 5, 0, 8+fw, cellh);
+                draw_text(x11, x + 9, White, Black, &bar.layout, 1);
+                break;
+            case SegSlots:
+                // draw window presence indicator
+                clear_segment(x11, x, w, White);
+                draw_text(x11, x + 4, Black, White, bar.indicator, SLOTS);
+                break;
+            case SegTitle:
+                // draw title of primary window, and with more of them
+                // showing the segment is split like the tiles are
+                clear_segment(x11, x, w, White);
+                int parts = 1;
+                for (int s = 1; s < SLOTS; s++)
+                    if (bar.titles[s] != NULL)
+                        parts = SLOTS;
+                int pw = w / parts;
+                for (int s = 0; s < parts; s++) {
+                    if (s > 0)
+                        XftDrawRect(x11->bdraw, &x11->colors[Gray], x + s*pw - 1, 4, 2, cellh - 8);
+                    if (bar.titles[s] != NULL)
+                        draw_title(x11->bdraw, Black, x + s*pw + 4, cellh - 5,
+                                   bar.titles[s], pw - 8);
+                }
+                break;
+            case SegBattery:
+                // sprites fill their whole box, so stripes go on last
+                clear_segment(x11, x, w, ((bar.bat >= 0) && (bar.bat < 20)) ? Red : White);
+                if (bar.bat < 0)
+                    break;
+                char blvl[5];
+                snprintf(blvl, sizeof(blvl), "%3d%%", bar.bat);
+                draw_text(x11, x, Black, (bar.bat < 20) ? Red : White, blvl, 4);
+                if (bar.ac == 1)
+                    XftDrawRect(x11->bdraw, &x11->colors[LightBlue], x, 0, w, cellh/5);
+                break;
+            case SegClock:
+                // timer based background, then the time over each part of it
+                clear_segment(x11, x, w, White);
+                if (bar.timer_fill > 0) {
+                    clear_segment(x11, x, bar.timer_fill, Gray);
+                    draw_text(x11, x + fw, Black, Gray, bar.clock, strlen(bar.clock));
+                }
+                clear_segment(x11, x + bar.timer_fill, w - bar.timer_fill, White);
+                draw_text(x11, x + fw, Black, White, bar.clock, strlen(bar.clock));
+                if (bar.timer_ack) {
+                    clip_segment(x11, x, w);
+                    XftDrawRect(x11->bdraw, &x11->colors[LightBlue], x, 0, w, cellh/5);
+                }
+                break;
+        }
+    }
+
+    // shown holds its own reference to the titles it displays
+    for (int s = 0; s < SLOTS; s++) {
+        retain_title(bar.titles[s]);
+        release_title(shown.titles[s]);
     }
+    shown = bar;
+    if (x0 >= x1)
+        return;
+
+    // single copy of everything that changed
+    XCopyArea(x11->dpy, x11->barbuf, x11->root, x11->gc,
+              x0, 0, x1 - x0, cellh, x0, 0);
 }
 
-int
-clip(int n)
+void
+spawn(const Arg *arg)
 {
-  return (n < 1) ? 9 : (n > 9) ? 1 : n;
+    char *const *argv = arg->v;
+
+    // children get a clean signal mask, SIGCHLD is blocked for the signalfd
+    // our own fds are all close-on-exec
+    posix_spawnattr_t attr;
+    sigset_t none;
+    sigemptyset(&none);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &none);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    pid_t pid;
+    if (posix_spawnp(&pid, argv[0], NULL, &attr, argv, environ) != 0)
+        fprintf(stderr, "Could not spawn %s\n", argv[0]);
+    posix_spawnattr_destroy(&attr);
 }
 
 void
-update_view(int prevy, int prevx){
-    if (!((prevy == ccy) && (prevx == ccx))) {
-        pcy = prevy;
-        pcx = prevx;
+handle_signals(int sfd)
+{
+    struct signalfd_siginfo si;
+    bool reap = false;
+    while (read(sfd, &si, sizeof(si)) == sizeof(si)) {
+        if (si.ssi_signo == SIGCHLD)
+            reap = true;
+        else if (si.ssi_signo == SIGUSR1)
+            dump_stats(x11.dpy);
     }
 
-    // unmap the windows show previously
-    Cell* prev = &cells[prevy][prevx];
-    if (prev->primary != NULL)
-        XUnmapWindow(x11.dpy, prev->primary->win);
-    if (prev->secondary != NULL)
-        XUnmapWindow(x11.dpy, prev->secondary->win);
-
-    // map the current cell's window(s) here
-    // TODO: update title here
-    Cell* curr = &cells[ccy][ccx];
-    if (curr->layout == Tiled) {
-        if (curr->primary != NULL)
-            XMapWindow(x11.dpy, curr->primary->win);
-        if (curr->secondary != NULL)
-            XMapWindow(x11.dpy, curr->secondary->win);
-    } else {
-        // only display one window in Monocle
-        if (curr->primary != NULL)
-            XMapWindow(x11.dpy, curr->primary->win);
-        else if (curr->secondary != NULL)
-            XMapWindow(x11.dpy, curr->secondary->win);
-    }
+    // signals coalesce, so reap everything that has exited
+    if (reap)
+        while (waitpid(-1, NULL, WNOHANG) > 0);
+}
 
-    if (hand != NULL)
-        XRaiseWindow(x11.dpy, x11.handwin);
+// thumbnail of the cell on screen, windows of other cells are unmapped
+// and have no contents, so a thumbnail only goes stale while its cell
+// is shown and is retaken once when the cell is left
+// it is read off the root, the hand card is taken down for it, but
+// override-redirect popups on screen end up in it
+void
+capture_view()
+{
+    if (captured || (viewy == 0))
+        return;
 
-    draw_bar(&x11);
+    // the card is mapped again as update_hand would
+    XUnmapWindow(x11.dpy, x11.handwin);
+    XRenderComposite(x11.dpy, PictOpSrc, x11.rootpic, None, x11.thumbpic, 0, 0, 0, 0,
+                     (viewx - 1) * x11.bw + 4, (viewy - 1) * x11.bh + 4,
+                     x11.bw - 8, x11.bh - 8);
+    if (nhand > 0)
+        XMapWindow(x11.dpy, x11.handwin);
+    thumbed[viewy] |= 1u << viewx;
+    captured = true;
 }
 
 void
-update_cell_layout()
+draw_overview()
 {
-    Cell* cell = &cells[ccy][ccx];
+    // thumbnails in one go, then patch up the cells without one
+    XCopyArea(x11.dpy, x11.thumbs, x11.overwin, x11.gc, 0, 0,
+              COLS * x11.bw, ROWS * x11.bh, 0, 0);
+    for (int y = 1; y <= ROWS; y++)
+        for (int x = 1; x <= COLS; x++) {
+            int bx = (x - 1) * x11.bw, by = (y - 1) * x11.bh;
+            bool occ = occupied[y] & (1u << x);
+            if (!occ || !(thumbed[y] & (1u << x)))
+                XftDrawRect(x11.odraw, &x11.colors[occ ? Gray : White], bx + 4, by + 4,
+                            x11.bw - 8, x11.bh - 8);
+
+            // frame, highlighted for the current cell
+            enum ColorType fc = ((y == ccy) && (x == ccx)) ? LightBlue : Black;
+            int t = (fc == LightBlue) ? 4 : 1;
+            XftDrawRect(x11.odraw, &x11.colors[fc], bx, by, x11.bw, t);
+            XftDrawRect(x11.odraw, &x11.colors[fc], bx, by + x11.bh - t, x11.bw, t);
+            XftDrawRect(x11.odraw, &x11.colors[fc], bx, by, t, x11.bh);
+            XftDrawRect(x11.odraw, &x11.colors[fc], bx + x11.bw - t, by, t, x11.bh);
+        }
+}
 
-    if (cell->layout == Tiled) {
-        if (cell->primary != NULL)
-            XMoveResizeWindow(x11.dpy, cell->primary->win, 0, cellh,
-                                x11.sw/2, x11.sh - cellh);
-        if (cell->secondary != NULL)
-            XMoveResizeWindow(x11.dpy, cell->secondary->win, x11.sw/2, cellh,
-                                x11.sw/2, x11.sh - cellh);
+void
+toggle_overview(const Arg *arg)
+{
+    overview = !overview;
+    if (overview) {
+        capture_view();
+        XMapRaised(x11.dpy, x11.overwin);
+        dirty |= DirtyOverview;
     } else {
-        if (cell->primary != NULL)
-            XMoveResizeWindow(x11.dpy, cell->primary->win, 0, cellh,
-                                x11.sw, x11.sh - cellh);
-        if (cell->secondary != NULL)
-            XMoveResizeWindow(x11.dpy, cell->secondary->win, 0, cellh,
-                                x11.sw, x11.sh - cellh);
-    }
-
-    update_view(ccy, ccx);
-}
-
-void
-kill_client(){
-    Cell* curr = &cells[ccy][ccx];
-    // TODO: lookup the focused client in a better way than this
-    // cannot kill secondary window with this logic
-    if (curr->primary != NULL) {
-        // this is the proper way to close a window
-        // I used XKillClient earlier, but that kills all windows of the target
-	XEvent ev;
-        ev.type = ClientMessage;
-        ev.xclient.window = curr->primary->win;
-        ev.xclient.message_type = XInternAtom(x11.dpy, "WM_PROTOCOLS", False);
-        ev.xclient.format = 32;
-        ev.xclient.data.l[0] = XInternAtom(x11.dpy, "WM_DELETE_WINDOW", False);
-        ev.xclient.data.l[1] = CurrentTime;
-        XSendEvent(x11.dpy, curr->primary->win, False, NoEventMask, &ev);
-
-        // remove this from the list of clients
-        delete_client(curr->primary);
-
-        curr->primary = NULL;
-        update_cell_layout();
+        // the view catches up with wherever we went meanwhile
+        XUnmapWindow(x11.dpy, x11.overwin);
+        dirty |= DirtyView | held;
+        held = 0;
     }
 }
 
 void
-place_hand()
+apply_ops()
 {
-    if (hand == NULL)
-        return;
-
-    Cell *c = &cells[ccy][ccx];
-    if (c->primary == NULL) {
-        c->primary = hand->cl;
-    } else if (c->secondary == NULL) {
-        c->secondary = hand->cl;
-    } else {
-        // nothing we can do from here
-        return;
+    for (unsigned int i = 0; i < nops; i++) {
+        Op *op = &ops[i];
+        switch (op->type) {
+            case OpMap:
+                XMapWindow(x11.dpy, op->win);
+                break;
+            case OpUnmap:
+                XUnmapWindow(x11.dpy, op->win);
+                break;
+            case OpMove:
+                XMoveResizeWindow(x11.dpy, op->win, op->x, op->y, op->w, op->h);
+                break;
+            case OpClose: {
+                // this is the proper way to close a window
+                // I used XKillClient earlier, but that kills all windows of the target
+                XEvent ev;
+                ev.type = ClientMessage;
+                ev.xclient.window = op->win;
+                ev.xclient.message_type = x11.atoms[WMProtocols];
+                ev.xclient.format = 32;
+                ev.xclient.data.l[0] = x11.atoms[WMDelete];
+                ev.xclient.data.l[1] = CurrentTime;
+                XSendEvent(x11.dpy, op->win, False, NoEventMask, &ev);
+                break;
+            }
+            case OpForget: {
+                // drop an unanswered title request
+                TitleReq *r = queued_title(op->c);
+                if (r != NULL)
+                    drop_title(r);
+                release_title(op->c->title);
+                free_client(op->c);
+                break;
+            }
+        }
     }
+    nops = 0;
+}
 
-    // place it in
-    hand->cl->cx = ccx;
-    hand->cl->cy = ccy;
+// start following a window we just took on, its title to begin with
+void
+watch_client(Client *c)
+{
+    c->title = intern_title("unknown", 7);
+    request_title(c);
 
-    // free up the hand
-    Hand* curr = hand;
-    hand = hand->next;
-    free(curr);
+    // follow title changes
+    XSelectInput(x11.dpy, c->win, PropertyChangeMask);
+}
 
-    update_hand();
-    update_cell_layout();
+// start managing a window, it is up to the caller to place it
+Client*
+manage(Window w)
+{
+    Client *c = new_client(w);
+    if (c != NULL)
+        watch_client(c);
+    return c;
 }
 
+// apply everything marked dirty since the last frame, in one flush
 void
-pickup_hand()
+commit_frame()
 {
-    Cell *c = &cells[ccy][ccx];
-    // nothing to pick up
-    if (c->primary == NULL)
-        return;
+    int64_t start = now_ns(), t;
+    bool raise = false, banner = false;
+
+    collect_titles();
+
+    if (dirty & DirtyHand)
+        update_hand();
+    // a cell is laid out when it comes into view, layout changes elsewhere
+    // only ever happen on the current cell, none of it shows under the
+    // overview, so it waits for it to close
+    if (overview) {
+        if (dirty & (DirtyLayout | DirtyView | DirtyOverview))
+            draw_overview();
+    } else if ((dirty & (DirtyLayout | DirtyView)) && (timer == ELAPSED)) {
+        // the break keeps the screen until it is acknowledged, whatever
+        // changed meanwhile shows up after it, the thumbnail is taken
+        // before the windows go and keeps the banner out
+        capture_view();
+        hide_view();
+        banner = true;
+    } else if (dirty & (DirtyLayout | DirtyView)) {
+        // the cell going away is captured before its windows do
+        if ((viewy != ccy) || (viewx != ccx))
+            capture_view();
+
+        t = now_ns();
+        update_cell_layout();
+        record(&stats.actions[StatLayout], t);
 
-    // Push a new entry into hand
-    Hand* curr = (Hand*)malloc(sizeof(Hand));
-    curr->cl = c->primary;
-    curr->cl->cx = curr->cl->cy = -1;
-    curr->next = hand;
-    hand = curr;
+        t = now_ns();
+        update_view();
+        record(&stats.actions[StatView], t);
+        captured = false;
+        raise = (nhand > 0);
+    }
 
-    // need to manually unmap this window
-    // TODO: make this cleaner
-    c->primary = NULL;
-    XUnmapWindow(x11.dpy, hand->cl->win);
+    // carry out what the core asked for, the card stays above the windows
+    apply_ops();
+    if (raise)
+        XRaiseWindow(x11.dpy, x11.handwin);
+    if (banner)
+        XftDrawRect(x11.fdraw, &x11.colors[Red], 0, x11.sh/2 - 100, x11.sw, 200);
 
-    update_hand();
-    update_cell_layout();
+    t = now_ns();
+    draw_bar(&x11);
+    record(&stats.actions[StatBar], t);
+    if (dirty & DirtyHand)
+        draw_hand();
+
+    // held apart from dirty, so only a change made while the overview is
+    // up redraws it
+    if (overview)
+        held |= dirty & (DirtyLayout | DirtyView);
+    dirty = 0;
+    XFlush(x11.dpy);
+    record(&stats.actions[StatFrame], start);
 }
 
+// arguments we were started with, to exec ourselves again
+char **wm_argv;
+
+// env variable carrying the fd with the state handed over on restart
+#define STATEENV "CELLWM_STATE"
+
 void
-handleKeyPress(XKeyEvent *ev)
+save_state(FILE *f)
 {
-    KeySym ksym = XKeycodeToKeysym(x11.dpy, ev->keycode, 0);
+    fprintf(f, "current %d %d\n", ccy, ccx);
+    fprintf(f, "previous %d %d\n", pcy, pcx);
+
+    // cell row col layout and the window of every slot, for every cell not
+    // at defaults
+    for (int y = 1; y <= ROWS; y++)
+        for (int x = 1; x <= COLS; x++) {
+            Cell *c = &cells[y][x];
+            if ((c->layout == Monocle) && !(occupied[y] & (1u << x)))
+                continue;
+            fprintf(f, "cell %d %d %d", y, x, c->layout);
+            for (int i = 0; i < SLOTS; i++)
+                fprintf(f, " 0x%lx", c->slots[i] ? c->slots[i]->win : 0);
+            fprintf(f, "\n");
+        }
 
-    int prevx, prevy;
-    switch (ksym)
-    {
-        case XK_Return:
-            spawn("vex");
-            break;
-        case XK_p:
-            spawn("dmenu_run");
-            break;
-        case XK_Left:
-            prevx = ccx; ccx = clip(ccx-1);
-            update_view(ccy, prevx); break;
-        case XK_Right:
-            prevx = ccx; ccx = clip(ccx+1);
-            update_view(ccy, prevx); break;
-        // actually with the shift mask here, but we are not checking
-        case XK_1: prevx = ccx; ccx = 1; update_view(ccy, prevx); break;
-        case XK_2: prevx = ccx; ccx = 2; update_view(ccy, prevx); break;
-        case XK_3: prevx = ccx; ccx = 3; update_view(ccy, prevx); break;
-        case XK_4: prevx = ccx; ccx = 4; update_view(ccy, prevx); break;
-        case XK_5: prevx = ccx; ccx = 5; update_view(ccy, prevx); break;
-        case XK_6: prevx = ccx; ccx = 6; update_view(ccy, prevx); break;
-        case XK_7: prevx = ccx; ccx = 7; update_view(ccy, prevx); break;
-        case XK_8: prevx = ccx; ccx = 8; update_view(ccy, prevx); break;
-        case XK_9: prevx = ccx; ccx = 9; update_view(ccy, prevx); break;
-        case XK_Up:
-            prevy = ccy; ccy = clip(ccy-1);
-            update_view(prevy, ccx); break;
-        case XK_Down:
-            prevy = ccy; ccy = clip(ccy+1);
-            update_view(prevy, ccx); break;
-        case XK_Tab:
-            prevy = ccy; prevx = ccx;
-            ccy = pcy; ccx = pcx;
-            update_view(prevy, prevx);
-            break;
-        case XK_k:
-            kill_client();
-            break;
-        case XK_m:
-            cells[ccy][ccx].layout = Monocle;
-            update_cell_layout();
-            break;
-        case XK_t:
-            cells[ccy][ccx].layout = Tiled;
-            update_cell_layout();
-            break;
-        case XK_f: // flip entries in the cell
-            Cell *curr = &cells[ccy][ccx];
-            Client *tmp = curr->primary;
-            curr->primary = curr->secondary;
-            curr->secondary = tmp;
-            update_cell_layout();
-            break;
-        case XK_i:
-            if (timer == OFF) {
-                timer = ON;
-                XftDrawRect(x11.fdraw, &x11.colors[LightBlue], x11.sw - 19*x11.font_width, 0,
-                    19*x11.font_width, cellh/5);
-            } else if (timer == ON) {
-                timer = OFF;
-                XftDrawRect(x11.fdraw, &x11.colors[LightBlue], x11.sw - 19*x11.font_width, 0,
-                    19*x11.font_width, cellh/5);
-            } else {
-                timer = OFF;
-                // undo the rectangle
-                XftDrawRect(x11.fdraw, &x11.colors[Black], 0, x11.sh/2 - 100,
-                            x11.sw, 200);
-                update_view(ccy, ccx);
-            }
-            break;
-        case XK_l:
-            place_hand();
-            break;
-        case XK_u:
-            pickup_hand();
-            break;
-        case XK_End:
-            exit(0);
-            break;
-    }
+    // bottom of the stack first
+    for (int i = hand_bottom; i >= 0; i = pool[i].above)
+        fprintf(f, "hand 0x%lx\n", pool[i].win);
 }
 
+// exec the binary again, which may have been rebuilt in the meantime,
+// handing over the placement of every window through a memfd
 void
-handleConfigureRequest(XConfigureRequestEvent *ev)
+restart(const Arg *arg)
 {
-    XWindowChanges changes;
+    int fd = memfd_create("cellwm-state", 0);
+    FILE *f = (fd >= 0) ? fdopen(fd, "w+") : NULL;
+    if (f == NULL) {
+        fprintf(stderr, "Could not save state\n");
+        return;
+    }
+    save_state(f);
+    fflush(f);
+    lseek(fd, 0, SEEK_SET);
+
+    char env[16];
+    snprintf(env, sizeof(env), "%d", fd);
+    setenv(STATEENV, env, 1);
+
+    // let go of the screen before the new instance asks for it
+    xcb_disconnect(x11.xcb);
+    XCloseDisplay(x11.dpy);
+    execvp(wm_argv[0], wm_argv);
+
+    // without a display there is no going back
+    fprintf(stderr, "Could not exec %s\n", wm_argv[0]);
+    exit(1);
+}
 
-    // copy in changes as-is from the event
-    // trying to make changes here does not work at all
+typedef struct Saved Saved;
+struct Saved
+{
+    Window win;
+    int y, x, slot;
+};
+
+typedef struct Found Found;
+struct Found
+{
+    Window win;
+    bool viewable, taken;
+};
+
+int
+cmp_found(const void *a, const void *b)
+{
+    Window x = ((const Found *)a)->win, y = ((const Found *)b)->win;
+    return (x > y) - (x < y);
+}
+
+Saved*
+add_saved(Saved *saved, int *nsaved, int *cap, Saved s)
+{
+    if (*nsaved == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        saved = (Saved*)realloc(saved, *cap * sizeof(Saved));
+    }
+    saved[(*nsaved)++] = s;
+    return saved;
+}
+
+// read back the state of a previous instance, windows are returned in
+// order with their slot in a cell and -1 for the hand, a build with fewer
+// slots puts the ones it has no room for in the hand
+Saved*
+load_state(int *nsaved)
+{
+    *nsaved = 0;
+    const char *env = getenv(STATEENV);
+    if (env == NULL)
+        return NULL;
+    int fd = atoi(env);
+    unsetenv(STATEENV);
+
+    FILE *f = fdopen(fd, "r");
+    if (f == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    Saved *saved = NULL;
+    int cap = 0;
+    // lines of a build with more slots are longer, read them whole
+    char *line = NULL;
+    size_t len = 0;
+    while (getline(&line, &len, f) != -1) {
+        int y, x, layout, n;
+        unsigned long w;
+
+        if (sscanf(line, "current %d %d", &y, &x) == 2) {
+            ccy = clip(y, ROWS);
+            ccx = clip(x, COLS);
+        } else if (sscanf(line, "previous %d %d", &y, &x) == 2) {
+            pcy = clip(y, ROWS);
+            pcx = clip(x, COLS);
+        } else if (sscanf(line, "cell %d %d %d%n", &y, &x, &layout, &n) == 3) {
+            // the windows of a cell a smaller build has no room for go to
+            // the hand
+            bool fits = (y >= 1) && (y <= ROWS) && (x >= 1) && (x <= COLS);
+            if (fits)
+                cells[y][x].layout = (layout == Tiled) ? Tiled : Monocle;
+            char *p = line + n, *end;
+            for (int i = 0; ; i++, p = end) {
+                w = strtoul(p, &end, 16);
+                if (end == p)
+                    break;
+                if (w == 0)
+                    continue;
+                Saved sv = fits ? (Saved){ w, y, x, i } : (Saved){ w, -1, -1, -1 };
+                saved = add_saved(saved, nsaved, &cap, sv);
+            }
+        } else if (sscanf(line, "hand %lx", &w) == 1) {
+            saved = add_saved(saved, nsaved, &cap, (Saved){ w, -1, -1, -1 });
+        }
+    }
+    free(line);
+    fclose(f);
+    return saved;
+}
+
+// take over the windows already on screen, with one query of the tree
+// and the attributes of all of them fetched in a single round trip
+void
+adopt_windows()
+{
+    int nsaved;
+    Saved *saved = load_state(&nsaved);
+
+    Window root, parent, *children = NULL;
+    unsigned int n = 0;
+    if (!XQueryTree(x11.dpy, x11.root, &root, &parent, &children, &n))
+        n = 0;
+
+    xcb_get_window_attributes_cookie_t *reqs =
+        (xcb_get_window_attributes_cookie_t*)malloc((n + 1) * sizeof(*reqs));
+    for (unsigned int i = 0; i < n; i++)
+        reqs[i] = xcb_get_window_attributes(x11.xcb, children[i]);
+    stats.xcb_requests += n;
+    if (n > 0)
+        stats.xcb_round_trips++;
+
+    // candidates, sorted by window for the lookups below
+    Found *found = (Found*)malloc((n + 1) * sizeof(Found));
+    int nfound = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        xcb_get_window_attributes_reply_t *r =
+            xcb_get_window_attributes_reply(x11.xcb, reqs[i], NULL);
+        if ((r != NULL) && !r->override_redirect && (children[i] != x11.handwin))
+            found[nfound++] = (Found){ children[i], r->map_state == XCB_MAP_STATE_VIEWABLE, false };
+        free(r);
+    }
+    qsort(found, nfound, sizeof(Found), cmp_found);
+
+    // windows we knew about go back where they were, the hand keeps its order
+    for (int i = 0; i < nsaved; i++) {
+        Found key = { saved[i].win, false, false };
+        Found *fw = bsearch(&key, found, nfound, sizeof(Found), cmp_found);
+        Client *c = ((fw == NULL) || fw->taken) ? NULL : manage(fw->win);
+        if (c == NULL)
+            continue;
+        fw->taken = true;
+
+        if ((saved[i].slot < 0) || !put_client(c, saved[i].y, saved[i].x, saved[i].slot))
+            push_hand(c);
+    }
+
+    // anything else visible is new to us, as if it had just been mapped
+    for (int i = 0; i < nfound; i++)
+        if (found[i].viewable && !found[i].taken) {
+            Client *c = manage(found[i].win);
+            if (c == NULL)
+                break;
+            found[i].taken = true;
+            place_client(c);
+        }
+
+    // only the current cell stays on screen, what is already mapped
+    // there is kept so it does not have to repaint
+    for (int i = 0; i < nfound; i++) {
+        if (!found[i].viewable || !found[i].taken)
+            continue;
+        Client *c = find_client(found[i].win);
+        int m = 0;
+        while ((m < SLOTS) && (mapped[m] != None))
+            m++;
+        if ((c->cy == ccy) && (c->cx == ccx) && (m < SLOTS))
+            mapped[m] = c->win;
+        else
+            XUnmapWindow(x11.dpy, c->win);
+    }
+
+    free(found);
+    free(reqs);
+    free(saved);
+    if (children != NULL)
+        XFree(children);
+
+    dirty |= DirtyHand | DirtyLayout | DirtyView | DirtyBar;
+}
+
+// path of the control socket, see handle_control
+char sockpath[108];
+
+// deadlines of everything time driven, kept in a min-heap with the one
+// timerfd armed to the earliest, on CLOCK_BOOTTIME which is monotonic but
+// keeps counting through suspend
+typedef struct Deadline Deadline;
+struct Deadline
+{
+    int64_t at;
+    void (*fire)();
+};
+Deadline deadlines[8];
+int ndeadlines;
+int tfd;
+
+void
+sift_deadline(int i)
+{
+    Deadline d = deadlines[i];
+
+    while ((i > 0) && (d.at < deadlines[(i - 1) / 2].at)) {
+        deadlines[i] = deadlines[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    while (true) {
+        int c = 2*i + 1;
+        if (c >= ndeadlines)
+            break;
+        if ((c + 1 < ndeadlines) && (deadlines[c + 1].at < deadlines[c].at))
+            c++;
+        if (d.at <= deadlines[c].at)
+            break;
+        deadlines[i] = deadlines[c];
+        i = c;
+    }
+    deadlines[i] = d;
+}
+
+void
+arm_timer()
+{
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (ndeadlines > 0) {
+        its.it_value.tv_sec = deadlines[0].at / NSEC;
+        its.it_value.tv_nsec = deadlines[0].at % NSEC;
+    }
+    timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+void
+cancel(void (*fire)())
+{
+    for (int i = 0; i < ndeadlines; i++)
+        if (deadlines[i].fire == fire) {
+            deadlines[i] = deadlines[--ndeadlines];
+            if (i < ndeadlines)
+                sift_deadline(i);
+            arm_timer();
+            return;
+        }
+}
+
+// each consumer has at most one deadline, scheduling again moves it
+void
+schedule(void (*fire)(), int64_t at)
+{
+    cancel(fire);
+    if (ndeadlines == LENGTH(deadlines))
+        return;
+
+    deadlines[ndeadlines].at = at;
+    deadlines[ndeadlines].fire = fire;
+    sift_deadline(ndeadlines++);
+    arm_timer();
+}
+
+void
+update_timer_fill()
+{
+    int tb_width = x11.segx[NumSegments] - x11.segx[SegClock];
+    int64_t elapsed = now_ns() - timer_start;
+    bar.timer_fill = (timer == ON) ? tb_width*elapsed/(timer_dur*NSEC) : 0;
+    dirty |= DirtyBar;
+}
+
+void
+pomodoro_done()
+{
+    // end of period
+    timer = ELAPSED;
+    update_timer_fill();
+
+    // windows stay hidden under the banner until the break is acknowledged
+    dirty |= DirtyView;
+}
+
+void
+toggle_timer(const Arg *arg)
+{
+    if (timer == OFF) {
+        timer = ON;
+        timer_start = now_ns();
+        schedule(pomodoro_done, timer_start + timer_dur*NSEC);
+        bar.timer_ack = true;
+        update_timer_fill();
+    } else if (timer == ON) {
+        timer = OFF;
+        cancel(pomodoro_done);
+        bar.timer_ack = true;
+        update_timer_fill();
+    } else {
+        timer = OFF;
+        // undo the rectangle
+        XftDrawRect(x11.fdraw, &x11.colors[Black], 0, x11.sh/2 - 100,
+                    x11.sw, 200);
+        dirty |= DirtyView;
+    }
+}
+
+void
+quit(const Arg *arg)
+{
+    unlink(sockpath);
+    exit(0);
+}
+
+// key bindings, dwm style
+#define MODKEY Mod1Mask
+
+typedef struct Key Key;
+struct Key
+{
+    unsigned int mod;
+    KeySym keysym;
+    void (*func)(const Arg *);
+    const Arg arg;
+};
+
+// the num keys are bound with shift to deal with an inverted number row,
+// those past COLS do nothing and columns past 9 are only reached by steps
+static const Key keys[] = {
+    { MODKEY,           XK_Return, spawn,             { .v = termcmd } },
+    { MODKEY,           XK_p,      spawn,             { .v = menucmd } },
+    { MODKEY,           XK_Left,   step_column,       { .i = -1 } },
+    { MODKEY,           XK_Right,  step_column,       { .i = +1 } },
+    { MODKEY,           XK_Up,     step_row,          { .i = -1 } },
+    { MODKEY,           XK_Down,   step_row,          { .i = +1 } },
+    { MODKEY|ShiftMask, XK_1,      view_column,       { .i = 1 } },
+    { MODKEY|ShiftMask, XK_2,      view_column,       { .i = 2 } },
+    { MODKEY|ShiftMask, XK_3,      view_column,       { .i = 3 } },
+    { MODKEY|ShiftMask, XK_4,      view_column,       { .i = 4 } },
+    { MODKEY|ShiftMask, XK_5,      view_column,       { .i = 5 } },
+    { MODKEY|ShiftMask, XK_6,      view_column,       { .i = 6 } },
+    { MODKEY|ShiftMask, XK_7,      view_column,       { .i = 7 } },
+    { MODKEY|ShiftMask, XK_8,      view_column,       { .i = 8 } },
+    { MODKEY|ShiftMask, XK_9,      view_column,       { .i = 9 } },
+    { MODKEY,           XK_Tab,    view_previous,     { 0 } },
+    { MODKEY,           XK_n,      goto_occupied,     { .i = +1 } },
+    { MODKEY,           XK_b,      goto_occupied,     { .i = -1 } },
+    { MODKEY,           XK_o,      goto_occupied_row, { 0 } },
+    { MODKEY,           XK_e,      goto_empty,        { 0 } },
+    { MODKEY,           XK_g,      toggle_overview,   { 0 } },
+    { MODKEY,           XK_k,      kill_client,       { 0 } },
+    { MODKEY,           XK_m,      set_layout,        { .i = Monocle } },
+    { MODKEY,           XK_t,      set_layout,        { .i = Tiled } },
+    { MODKEY,           XK_f,      flip_cell,         { 0 } },
+    { MODKEY,           XK_i,      toggle_timer,      { 0 } },
+    { MODKEY,           XK_l,      place_hand,        { 0 } },
+    { MODKEY,           XK_u,      pickup_hand,       { 0 } },
+    { MODKEY,           XK_r,      restart,           { 0 } },
+    { MODKEY,           XK_End,    quit,              { 0 } },
+};
+
+// binding of every keycode and modifier combination, as an index into
+// keys plus one, so a key press is resolved with one load
+unsigned char keymap[256][16];
+
+// modifiers that tell bindings apart, lock keys are ignored
+int
+modindex(unsigned int state)
+{
+    return ((state & ShiftMask) ? 1 : 0) | ((state & ControlMask) ? 2 : 0) |
+           ((state & Mod1Mask) ? 4 : 0) | ((state & Mod4Mask) ? 8 : 0);
+}
+
+// (re)build the keymap from the keyboard mapping and grab what is bound
+void
+grab_keys()
+{
+    // little trick lifted from dwm
+    unsigned int modifiers[] = { 0, LockMask, Mod2Mask, Mod2Mask|LockMask };
+
+    memset(keymap, 0, sizeof(keymap));
+    XUngrabKey(x11.dpy, AnyKey, AnyModifier, x11.root);
+
+    int start, end, skip;
+    XDisplayKeycodes(x11.dpy, &start, &end);
+    KeySym *syms = XGetKeyboardMapping(x11.dpy, start, end - start + 1, &skip);
+    if (syms == NULL)
+        return;
+
+    for (int code = start; (code <= end) && (code < 256); code++)
+        for (unsigned int k = 0; k < LENGTH(keys); k++) {
+            unsigned char *slot = &keymap[code][modindex(keys[k].mod)];
+            if (*slot != 0)
+                continue;
+            // any level of the key, like XKeysymToKeycode
+            for (int l = 0; l < skip; l++)
+                if (syms[(code - start) * skip + l] == keys[k].keysym) {
+                    *slot = k + 1;
+                    for (unsigned int j = 0; j < LENGTH(modifiers); j++)
+                        XGrabKey(x11.dpy, code, keys[k].mod | modifiers[j], x11.root,
+                                 False, GrabModeAsync, GrabModeAsync);
+                    break;
+                }
+        }
+    XFree(syms);
+}
+
+void
+handleKeyPress(XKeyEvent *ev)
+{
+    unsigned char k = keymap[ev->keycode & 0xFF][modindex(ev->state)];
+    if (k != 0)
+        keys[k - 1].func(&keys[k - 1].arg);
+}
+
+void
+handleMappingNotify(XMappingEvent *ev)
+{
+    XRefreshKeyboardMapping(ev);
+    if ((ev->request == MappingKeyboard) || (ev->request == MappingModifier))
+        grab_keys();
+}
+
+void
+handleConfigureRequest(XConfigureRequestEvent *ev)
+{
+    Client *c = find_client(ev->window);
+    if ((c != NULL) && (c->w != 0)) {
+        // managed and placed, the client gets the geometry we chose
+        // a synthetic notify is enough, nothing changes on the server
+        XConfigureEvent ce;
+        ce.type = ConfigureNotify;
+        ce.display = x11.dpy;
+        ce.event = c->win;
+        ce.window = c->win;
+        ce.x = c->x;
+        ce.y = c->y;
+        ce.width = c->w;
+        ce.height = c->h;
+        ce.border_width = 0;
+        ce.above = None;
+        ce.override_redirect = False;
+        XSendEvent(x11.dpy, c->win, False, StructureNotifyMask, (XEvent *)&ce);
+        return;
+    }
+
+    XWindowChanges changes;
+
+    // copy in changes as-is from the event
+    // trying to make changes here does not work at all
     changes.x = ev->x;
     changes.y = ev->y;
     changes.width = ev->width;
@@ -581,63 +1728,22 @@ handleConfigureRequest(XConfigureRequestEvent *ev)
 void
 handleMapRequest(XMapRequestEvent *ev)
 {
-    // window may already exist
-    bool found = false;
-    Client *c;
-    for (c = clients; c; c = c->next)
-        if (c->win == ev->window) {
-            found = true;
-            break;
-        }
-
-    if (!found) {
-        // window does not already exist
-        c = (Client *)malloc(sizeof(Client));
-        c->win = ev->window;
-
-        // update global store
-        c->next = clients;
-        clients = c;
-
-        // assume we can place this client
-        c->cx = ccx;
-        c->cy = ccy;
-        get_title(c);
-
-        Cell* cc = &cells[ccy][ccx];
-        // find the right slot to put it in
-        if (cc->primary == NULL) {
-            cc->primary = c;
-        } else if (cc->secondary == NULL) {
-            cc->secondary = c;
-        } else {
-            // we can't place this window yet
-            c->cx = -1;
-            c->cy = -1;
-
-            // put it in hand
-            Hand* new_entry = (Hand*)malloc(sizeof(Hand));
-            new_entry->cl = c;
-            new_entry->next = hand;
-            hand = new_entry;
-
-            update_hand();
-        }
+    bool fresh = (find_client(ev->window) == NULL);
+    Client *c = client_mapped(ev->window);
+    if (c == NULL) {
+        // out of slots, let it show up unmanaged
+        XMapWindow(x11.dpy, ev->window);
+        return;
     }
-
-    update_cell_layout();
-    update_view(ccy, ccx);
+    if (fresh)
+        watch_client(c);
 }
 
 void
 handleDestroyNotify(XDestroyWindowEvent *ev)
 {
     // find the client
-    Client *c;
-    for(c = clients;c;c = c->next) {
-      if (c->win == ev->window)
-          break;
-    }
+    Client *c = find_client(ev->window);
 
     if (c == NULL) {
         // client with window not found
@@ -646,152 +1752,521 @@ handleDestroyNotify(XDestroyWindowEvent *ev)
         return;
     }
 
-    // undo the mapping in the cells structure
-    if (c == cells[c->cy][c->cx].primary)
-        cells[c->cy][c->cx].primary = NULL;
-    if (c == cells[c->cy][c->cx].secondary)
-        cells[c->cy][c->cx].secondary = NULL;
+    forget_client(c);
+}
 
-    delete_client(c);
-    update_cell_layout();
-    draw_bar(&x11);
+void
+handlePropertyNotify(XPropertyEvent *ev)
+{
+    if ((ev->atom != x11.atoms[NetWMName]) && (ev->atom != XA_WM_NAME))
+        return;
+
+    Client *c = find_client(ev->window);
+    if (c != NULL)
+        request_title(c);
 }
 
 void
-timer_update()
+handleExpose(XExposeEvent *ev)
 {
-    time_t t;
-    struct tm *tm_info;
-    char tstr[20];
+    if (ev->window == x11.handwin) {
+        XCopyArea(x11.dpy, x11.handbuf, x11.handwin, x11.gc,
+                  ev->x, ev->y, ev->width, ev->height, ev->x, ev->y);
+        return;
+    }
+    if (ev->window == x11.overwin) {
+        dirty |= DirtyOverview;
+        return;
+    }
 
-    // get current battery status
-    FILE* fd_power = fopen("/sys/class/power_supply/AC/online", "r");
-    FILE* fd_batt = fopen("/sys/class/power_supply/BAT0/capacity", "r");
-    int ac, bat;
-    fscanf(fd_power, "%d", &ac);
-    fscanf(fd_batt, "%d", &bat);
-    fclose(fd_power);
-    fclose(fd_batt);
+    // repair the bar from its pixmap, eg, once dmenu goes away
+    if ((ev->window != x11.root) || (ev->y >= cellh))
+        return;
 
-    // get current time
-    t = time(NULL);
-    tm_info = localtime(&t);
-    strftime(tstr, 20, "%a %b %e, %H:%M", tm_info);
+    int h = (ev->y + ev->height > cellh) ? cellh - ev->y : ev->height;
+    XCopyArea(x11.dpy, x11.barbuf, x11.root, x11.gc,
+              ev->x, ev->y, ev->width, h, ev->x, ev->y);
+}
 
-    // run pomodoro checks and updates
-    if (timer == ON) {
-        timer_elapsed += 30;
+// power supplies, found once under sysfs and read through persistent fds
+#define MAXSUPPLIES 8
+int ac_fds[MAXSUPPLIES], nac;
+int bat_fds[MAXSUPPLIES], nbat;
 
-        if (timer_elapsed >= timer_dur) {
-            // end of period
-            timer = ELAPSED;
-            timer_elapsed = 0;
+int
+read_supply(int fd)
+{
+    char buf[16];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0)
+        return -1;
+    buf[n] = '\0';
+    return atoi(buf);
+}
+
+void
+power_setup()
+{
+    for (int i = 0; i < nac; i++)
+        close(ac_fds[i]);
+    for (int i = 0; i < nbat; i++)
+        close(bat_fds[i]);
+    nac = nbat = 0;
+
+    DIR *dir = opendir("/sys/class/power_supply");
+    if (dir == NULL)
+        return;
+
+    struct dirent *d;
+    char path[512], type[16];
+    while ((d = readdir(dir)) != NULL) {
+        if (d->d_name[0] == '.')
+            continue;
+
+        snprintf(path, sizeof(path), "/sys/class/power_supply/%s/type", d->d_name);
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        ssize_t n = read(fd, type, sizeof(type) - 1);
+        close(fd);
+        if (n <= 0)
+            continue;
+        type[n] = '\0';
+
+        if (!strncmp(type, "Mains", 5) && (nac < MAXSUPPLIES)) {
+            snprintf(path, sizeof(path), "/sys/class/power_supply/%s/online", d->d_name);
+            if ((fd = open(path, O_RDONLY | O_CLOEXEC)) >= 0)
+                ac_fds[nac++] = fd;
+        } else if (!strncmp(type, "Battery", 7) && (nbat < MAXSUPPLIES)) {
+            snprintf(path, sizeof(path), "/sys/class/power_supply/%s/capacity", d->d_name);
+            if ((fd = open(path, O_RDONLY | O_CLOEXEC)) >= 0)
+                bat_fds[nbat++] = fd;
         }
     }
-    if (timer == ELAPSED) {
-        XftDrawRect(x11.fdraw, &x11.colors[Red], 0, x11.sh/2 - 100,
-                    x11.sw, 200);
-        // hide window temporarily
-        Cell* c = &cells[ccy][ccx];
-        if (c->primary != NULL)
-            XUnmapWindow(x11.dpy, c->primary->win);
-        if (c->secondary != NULL)
-            XUnmapWindow(x11.dpy, c->secondary->win);
-    }
-
-    // draw battery info onto bar
-    XftDrawRect(x11.fdraw, &x11.colors[White], x11.sw - 24*x11.font_width, 0,
-                5*x11.font_width, cellh);
-    char blvl[4];
-    sprintf(blvl, "%3d", bat); blvl[3] = '%';
-    if (bat < 20)
-        XftDrawRect(x11.fdraw, &x11.colors[Red], x11.sw - 24*x11.font_width, 0,
-                    5*x11.font_width, cellh);
-    if (ac == 1)
-        XftDrawRect(x11.fdraw, &x11.colors[LightBlue], x11.sw - 24*x11.font_width, 0,
-                    5*x11.font_width, cellh/5);
-    XftDrawString8(x11.fdraw, &x11.colors[Black], x11.font,
-                x11.sw - 24*x11.font_width,
-                cellh - 5,
-                (XftChar8 *)&blvl, 4);
-
-    // draw timer based background onto bar
-    int tb_width = 19*x11.font_width;
-    XftDrawRect(x11.fdraw, &x11.colors[White], x11.sw - tb_width, 0,
-                tb_width, cellh);
-
-    if (timer == ON)
-        XftDrawRect(x11.fdraw, &x11.colors[Gray], x11.sw - tb_width, 0,
-                    tb_width*timer_elapsed/timer_dur, cellh);
-
-    // write time
-    XftDrawString8(x11.fdraw, &x11.colors[Black], x11.font,
-                x11.sw - 18*x11.font_width,
-                cellh - 5,
-                (XftChar8 *)&tstr, 20);
-
-    XSync(x11.dpy, False);
-
-    return;
-}
-
-int main() {
-    if (!x11_setup(&x11))
-        return 1;
+    closedir(dir);
+}
 
-    clients = NULL;
-    hand = NULL;
+void
+power_update()
+{
+    // on ac if any supply is online, the mean over all batteries
+    bar.ac = 0;
+    for (int i = 0; i < nac; i++)
+        if (read_supply(ac_fds[i]) == 1)
+            bar.ac = 1;
+
+    int sum = 0, n = 0;
+    for (int i = 0; i < nbat; i++) {
+        int cap = read_supply(bat_fds[i]);
+        if (cap >= 0) {
+            sum += cap;
+            n++;
+        }
+    }
+    bar.bat = n ? sum / n : -1;
 
-    draw_bar(&x11);
+    dirty |= DirtyBar;
+}
 
-    struct itimerspec delta;
-    uint64_t exp;
-    delta.it_value.tv_sec = 1; // initial timer
-    delta.it_value.tv_nsec = 0;
-    delta.it_interval.tv_sec = 30; // repeat interval
-    delta.it_interval.tv_nsec = 0;    
-    int tfd = timerfd_create(CLOCK_REALTIME, 0);
-    timerfd_settime(tfd, 0, &delta, NULL);
-
-    int maxfd;
-    fd_set readable;
+int
+power_monitor()
+{
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    NETLINK_KOBJECT_UEVENT);
+    if (fd < 0)
+        return -1;
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1; // kernel events
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void
+handle_uevent(int fd)
+{
+    // each message is "action@devpath" followed by KEY=value fields
+    char buf[4096];
+    bool changed = false, rescan = false;
+    ssize_t n;
+    while ((n = recv(fd, buf, sizeof(buf) - 1, 0)) > 0) {
+        buf[n] = '\0';
+        for (char *f = buf; f < buf + n; f += strlen(f) + 1)
+            if (!strcmp(f, "SUBSYSTEM=power_supply")) {
+                changed = true;
+                if (!strncmp(buf, "add@", 4) || !strncmp(buf, "remove@", 7))
+                    rescan = true;
+            }
+    }
+
+    if (rescan)
+        power_setup();
+    if (changed)
+        power_update();
+}
+
+void
+tick_power()
+{
+    // catch capacity drift the kernel does not send uevents for
+    power_update();
+    schedule(tick_power, now_ns() + 60 * NSEC);
+}
+
+void
+tick_clock()
+{
+    time_t t = time(NULL);
+    strftime(bar.clock, 20, "%a %b %e, %H:%M", localtime(&t));
+    update_timer_fill();
+    bar.timer_ack = false;
+    dirty |= DirtyBar;
+
+    // wake right at the next minute of the wall clock
+    struct timespec rt;
+    clock_gettime(CLOCK_REALTIME, &rt);
+    schedule(tick_clock, now_ns() + (60 - rt.tv_sec % 60) * NSEC - rt.tv_nsec);
+}
+
+// an fd polled by the main loop, with the callback that services it
+typedef struct Source Source;
+struct Source
+{
+    int fd;
+    void (*handle)(int fd);
+};
+
+int epfd;
+
+void
+add_source(Source *src)
+{
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = src;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, src->fd, &ev);
+}
+
+void
+handle_x(int fd)
+{
+    (void)fd;
     XEvent ev;
 
-    maxfd = tfd > x11.fd ? tfd : x11.fd;
+    while (XPending(x11.dpy)) {
+        XNextEvent(x11.dpy, &ev);
+        int64_t start = now_ns();
 
-    while(true) {
-        FD_ZERO(&readable);
-        FD_SET(tfd, &readable);
-        FD_SET(x11.fd, &readable);
+        switch(ev.type) {
+            case KeyPress:
+                handleKeyPress(&ev.xkey);
+                break;
+            case ConfigureRequest:
+                handleConfigureRequest(&ev.xconfigurerequest);
+                break;
+            case MapRequest:
+                handleMapRequest(&ev.xmaprequest);
+                break;
+            case DestroyNotify:
+                handleDestroyNotify(&ev.xdestroywindow);
+                break;
+            case Expose:
+                handleExpose(&ev.xexpose);
+                break;
+            case PropertyNotify:
+                handlePropertyNotify(&ev.xproperty);
+                break;
+            case MappingNotify:
+                handleMappingNotify(&ev.xmapping);
+                break;
+        }
+        if ((ev.type >= 0) && (ev.type < LASTEvent))
+            record(&stats.events[ev.type], start);
+    }
+}
+
+void
+handle_timer(int fd)
+{
+    uint64_t exp;
+    read(fd, &exp, sizeof(uint64_t));
+
+    // fire everything due, consumers schedule their next deadline themselves
+    int64_t now = now_ns();
+    int64_t start = now;
+    while ((ndeadlines > 0) && (deadlines[0].at <= now)) {
+        void (*fire)() = deadlines[0].fire;
+        cancel(fire);
+        fire();
+    }
+    record(&stats.actions[StatTimer], start);
+}
+
+// control socket, a line oriented protocol: every line is one command and
+// gets "ok" or "error ..." back, all lines read in one go are applied
+// before the next frame, so a whole batch costs one redraw
+#define MAXCONNS 8
 
-        select(maxfd + 1, &readable, NULL, NULL, NULL);
+typedef struct Conn Conn;
+struct Conn
+{
+    Source src;
+    int len;
+    char buf[4096];
+};
+Conn conns[MAXCONNS];
+
+void
+reply(int fd, const char *fmt, ...)
+{
+    char out[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(out, sizeof(out), fmt, ap);
+    va_end(ap);
+    if (n > (int)sizeof(out) - 1)
+        n = sizeof(out) - 1;
+    send(fd, out, n, MSG_NOSIGNAL);
+}
+
+void
+query_state(int fd)
+{
+    reply(fd, "current %d %d\n", ccy, ccx);
+    reply(fd, "previous %d %d\n", pcy, pcx);
+
+    reply(fd, "hand %u\n", nhand);
+
+    // occupied cells, row col layout and the window of every slot
+    for (int y = 1; y <= ROWS; y++)
+        for (int x = 1; x <= COLS; x++) {
+            Cell *c = &cells[y][x];
+            if (!(occupied[y] & (1u << x)))
+                continue;
+            reply(fd, "cell %d %d %s", y, x, (c->layout == Tiled) ? "tiled" : "monocle");
+            for (int i = 0; i < SLOTS; i++)
+                reply(fd, " 0x%lx", c->slots[i] ? c->slots[i]->win : 0);
+            reply(fd, "\n");
+        }
+}
+
+void
+run_command(int fd, char *line)
+{
+    char *save;
+    char *cmd = strtok_r(line, " \t", &save);
+    char *arg1 = strtok_r(NULL, " \t", &save);
+    char *arg2 = strtok_r(NULL, " \t", &save);
+
+    if (cmd == NULL)
+        return;
+
+    if (!strcmp(cmd, "goto") && arg1 && arg2) {
+        int y = atoi(arg1), x = atoi(arg2);
+        if ((y < 1) || (y > ROWS) || (x < 1) || (x > COLS)) {
+            reply(fd, "error no cell %s %s\n", arg1, arg2);
+            return;
+        }
+        goto_cell(y, x);
+    } else if (!strcmp(cmd, "next")) {
+        goto_occupied(&(Arg){ .i = 1 });
+    } else if (!strcmp(cmd, "prev")) {
+        goto_occupied(&(Arg){ .i = -1 });
+    } else if (!strcmp(cmd, "nextrow")) {
+        goto_occupied_row(NULL);
+    } else if (!strcmp(cmd, "empty")) {
+        goto_empty(NULL);
+    } else if (!strcmp(cmd, "overview")) {
+        toggle_overview(NULL);
+    } else if (!strcmp(cmd, "place")) {
+        place_hand(NULL);
+    } else if (!strcmp(cmd, "pickup")) {
+        pickup_hand(NULL);
+    } else if (!strcmp(cmd, "flip")) {
+        flip_cell(NULL);
+    } else if (!strcmp(cmd, "layout") && arg1 && !strcmp(arg1, "monocle")) {
+        set_layout(&(Arg){ .i = Monocle });
+    } else if (!strcmp(cmd, "layout") && arg1 && !strcmp(arg1, "tiled")) {
+        set_layout(&(Arg){ .i = Tiled });
+    } else if (!strcmp(cmd, "kill")) {
+        kill_client(NULL);
+    } else if (!strcmp(cmd, "query")) {
+        query_state(fd);
+    } else if (!strcmp(cmd, "restart")) {
+        reply(fd, "ok\n");
+        restart(NULL);
+    } else {
+        reply(fd, "error unknown command %s\n", cmd);
+        return;
+    }
+    reply(fd, "ok\n");
+}
+
+void
+handle_conn(int fd)
+{
+    Conn *c = NULL;
+    for (int i = 0; i < MAXCONNS; i++)
+        if (conns[i].src.fd == fd)
+            c = &conns[i];
+    if (c == NULL)
+        return;
+
+    ssize_t n;
+    while ((n = read(fd, c->buf + c->len, sizeof(c->buf) - c->len)) > 0) {
+        c->len += n;
+
+        // run every complete line, keep a partial one for later
+        char *line = c->buf, *nl;
+        while ((nl = memchr(line, '\n', c->buf + c->len - line)) != NULL) {
+            *nl = '\0';
+            run_command(fd, line);
+            line = nl + 1;
+        }
+        c->len -= line - c->buf;
+        memmove(c->buf, line, c->len);
 
-        if (FD_ISSET(tfd, &readable)) {
-            read(tfd, &exp, sizeof(uint64_t));
-            timer_update();
+        // a line longer than the buffer is never going to make sense
+        if (c->len == sizeof(c->buf)) {
+            n = 0;
+            break;
+        }
+    }
+
+    if ((n == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+        close(fd);
+        c->src.fd = -1;
+    }
+}
+
+void
+handle_control(int lfd)
+{
+    int fd;
+    while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        Conn *c = NULL;
+        for (int i = 0; (c == NULL) && (i < MAXCONNS); i++)
+            if (conns[i].src.fd < 0)
+                c = &conns[i];
+        if (c == NULL) {
+            close(fd);
             continue;
         }
 
-        while (XPending(x11.dpy)) {
-            XNextEvent(x11.dpy, &ev);
+        c->src.fd = fd;
+        c->src.handle = handle_conn;
+        c->len = 0;
+        add_source(&c->src);
+    }
+}
 
-            // windows on top need continuous drawing
-            draw_hand();
+int
+control_socket()
+{
+    for (int i = 0; i < MAXCONNS; i++)
+        conns[i].src.fd = -1;
+
+    runtime_path(sockpath, sizeof(sockpath), ".sock");
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, sockpath, sizeof(addr.sun_path) - 1);
+
+    // a previous instance may have left its socket behind, one that still
+    // answers belongs to a live instance and is not ours to take
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "Another instance listens on %s\n", sockpath);
+        sockpath[0] = '\0';
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    unlink(sockpath);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    mode_t mask = umask(077);
+    int ok = (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) && (listen(fd, 4) == 0);
+    umask(mask);
+    if (!ok) {
+        fprintf(stderr, "Could not listen on %s\n", sockpath);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
 
-            switch(ev.type) {
-                case KeyPress:
-                    handleKeyPress(&ev.xkey);
-                    break;
-                case ConfigureRequest:
-                    handleConfigureRequest(&ev.xconfigurerequest);
-                    break;
-                case MapRequest:
-                    handleMapRequest(&ev.xmaprequest);
-                    break;
-                case DestroyNotify:
-                    handleDestroyNotify(&ev.xdestroywindow);
-                    break;
-            }
+int main(int argc, char *argv[]) {
+    (void)argc;
+    wm_argv = argv;
+
+    if (!x11_setup(&x11))
+        return 1;
+    grab_keys();
+
+    // windows go below the bar
+    set_viewport(0, cellh, x11.sw, x11.sh - cellh);
+    adopt_windows();
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    tfd = timerfd_create(CLOCK_BOOTTIME, TFD_CLOEXEC);
+
+    // exited children are reaped through a signalfd, SIGUSR1 dumps stats
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGCHLD);
+    sigaddset(&sigs, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &sigs, NULL);
+    int sfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    // power supply changes, pushed by the kernel
+    power_setup();
+    int ufd = power_monitor();
+
+    int cfd = control_socket();
+
+    tick_clock();
+    tick_power();
+
+    Source sources[] = {
+        { x11.fd, handle_x },
+        { tfd, handle_timer },
+        { sfd, handle_signals },
+        { ufd, handle_uevent },
+        { cfd, handle_control },
+    };
+    for (unsigned int i = 0; i < LENGTH(sources); i++)
+        if (sources[i].fd >= 0)
+            add_source(&sources[i]);
+
+    struct epoll_event ready[LENGTH(sources) + MAXCONNS];
+
+    while(true) {
+        // xlib may have queued events while waiting on a reply, they never
+        // show up on the fd, so always drain before going to sleep
+        handle_x(x11.fd);
+
+        // everything queued is in, now show the final state once
+        commit_frame();
+
+        // service every ready source in one pass
+        int n = epoll_wait(epfd, ready, LENGTH(ready), -1);
+        for (int i = 0; i < n; i++) {
+            Source *src = ready[i].data.ptr;
+            src->handle(src->fd);
         }
     }
 }